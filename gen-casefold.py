@@ -0,0 +1,61 @@
+#!/usr/bin/env python3
+#
+# Generates libpicodict-casefold.h, case folding table for UTF-8 sort modes,
+# from Unicode data of Python's unicodedata module.
+#
+# Usage: gen-casefold.py > libpicodict-casefold.h
+#
+
+import unicodedata
+
+def fold(c):
+    """Simple (single code point) case folding of c, or c itself"""
+    s = chr(c)
+    for f in (s.casefold(), s.lower()):
+        if len(f) == 1:
+            return ord(f)
+    return c
+
+# Ranges of code points mapped with the same delta, either every code point
+# (stride 1) or every second one (stride 2, upper- and lowercase letters
+# interleaved)
+ranges = []
+for c in range(0x80, 0x110000):
+    if 0xd800 <= c < 0xe000:
+        continue
+    delta = fold(c) - c
+    if delta == 0:
+        continue
+    if ranges:
+        r = ranges[-1]
+        if r['delta'] == delta:
+            # Skipped code point must not be folded itself, so that ranges
+            # don't overlap
+            if (r['last'] == r['first'] and c - r['last'] == 2
+                    and fold(c - 1) == c - 1):
+                r['stride'] = 2
+            if c - r['last'] == r['stride']:
+                r['last'] = c
+                continue
+    ranges.append({'first': c, 'last': c, 'delta': delta, 'stride': 1})
+
+for r, next in zip(ranges, ranges[1:]):
+    assert r['last'] < next['first']
+
+print('''/*
+ * Generated by gen-casefold.py from Unicode %s data, do not edit.
+ *
+ * Simple case folding of non-ASCII code points: code points first..last,
+ * every stride-th one starting from first, are folded to code point + delta.
+ */
+
+static const struct {
+    uint32_t first;
+    uint32_t last;
+    int32_t delta;
+    uint8_t stride;
+} _pd_casefold_ranges[] = {''' % unicodedata.unidata_version)
+for r in ranges:
+    print('    { 0x%04x, 0x%04x, %d, %d },'
+          % (r['first'], r['last'], r['delta'], r['stride']))
+print('};')
@@ -0,0 +1,133 @@
+/*
+ * libpicodict - dictd dictionary format reading library
+ *
+ * Copyright © 2010 Mikhail Gusarov <dottedmag@dottedmag.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "libpicodict-pool.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+typedef struct _pd_task {
+    struct _pd_task *next;
+    void (*fn)(void *);
+    void *arg;
+} _pd_task;
+
+struct _pd_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    /* Queue of tasks, tail points to next of the last one */
+    _pd_task *head;
+    _pd_task **tail;
+    bool stopping;
+
+    unsigned threads;
+    pthread_t tids[];
+};
+
+static void *
+_pd_pool_worker(void *arg)
+{
+    _pd_pool *pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->head && !pool->stopping)
+            pthread_cond_wait(&pool->wakeup, &pool->lock);
+
+        _pd_task *task = pool->head;
+        if (!task)
+            break;
+
+        pool->head = task->next;
+        if (!pool->head)
+            pool->tail = &pool->head;
+
+        pthread_mutex_unlock(&pool->lock);
+        (*task->fn)(task->arg);
+        free(task);
+        pthread_mutex_lock(&pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+_pd_pool *
+_pd_pool_new(unsigned threads)
+{
+    _pd_pool *pool = calloc(1, sizeof(_pd_pool) + threads * sizeof(pthread_t));
+    if (!pool)
+        return NULL;
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wakeup, NULL);
+    pool->tail = &pool->head;
+
+    for (unsigned i = 0; i < threads; ++i) {
+        if (pthread_create(&pool->tids[pool->threads], NULL,
+                           _pd_pool_worker, pool))
+            break;
+        pool->threads++;
+    }
+
+    return pool;
+}
+
+unsigned
+_pd_pool_threads(_pd_pool *pool)
+{
+    return pool->threads;
+}
+
+bool
+_pd_pool_submit(_pd_pool *pool, void (*fn)(void *), void *arg)
+{
+    if (pool->threads == 0)
+        return false;
+
+    _pd_task *task = malloc(sizeof(_pd_task));
+    if (!task)
+        return false;
+    task->next = NULL;
+    task->fn = fn;
+    task->arg = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    *pool->tail = task;
+    pool->tail = &task->next;
+    pthread_cond_signal(&pool->wakeup);
+    pthread_mutex_unlock(&pool->lock);
+    return true;
+}
+
+void
+_pd_pool_free(_pd_pool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->wakeup);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (unsigned i = 0; i < pool->threads; ++i)
+        pthread_join(pool->tids[i], NULL);
+
+    pthread_cond_destroy(&pool->wakeup);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
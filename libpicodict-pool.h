@@ -0,0 +1,62 @@
+/*
+ * libpicodict - dictd dictionary format reading library
+ *
+ * Copyright © 2010 Mikhail Gusarov <dottedmag@dottedmag.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Worker pool used internally by libpicodict. Tasks are run by a fixed set of
+ * threads in the order they were submitted.
+ */
+
+#ifndef PICODICT_POOL_H
+#define PICODICT_POOL_H
+
+#include <stdbool.h>
+
+#define PD_INTERNAL __attribute__((visibility("hidden")))
+
+typedef struct _pd_pool _pd_pool;
+
+/*
+ * Starts pool of given number of threads. Pool may end up having fewer
+ * threads (even none) if threads can't be created.
+ */
+PD_INTERNAL _pd_pool *
+_pd_pool_new(unsigned threads);
+
+/*
+ * Returns number of threads pool actually has.
+ */
+PD_INTERNAL unsigned
+_pd_pool_threads(_pd_pool *pool);
+
+/*
+ * Queues fn(arg) to be run by one of the threads of pool. Returns false if
+ * pool has no threads or memory can't be allocated: it is up to caller to run
+ * task in this case.
+ */
+PD_INTERNAL bool
+_pd_pool_submit(_pd_pool *pool, void (*fn)(void *), void *arg);
+
+/*
+ * Runs all queued tasks, stops threads of pool and frees it.
+ */
+PD_INTERNAL void
+_pd_pool_free(_pd_pool *pool);
+
+#endif
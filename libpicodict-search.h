@@ -0,0 +1,294 @@
+/*
+ * libpicodict - dictd dictionary format reading library
+ *
+ * Copyright © 2010 Mikhail Gusarov <dottedmag@dottedmag.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Search functions specialized for single comparison function. This file is
+ * included by libpicodict.c several times, with the following macros defined
+ * before each inclusion:
+ *
+ * PD_SEARCH_CMP    - comparison function, taking two unsigned char pointers
+ *                    (see _pd_cmp)
+ * PD_SEARCH_SUFFIX - suffix for names of generated functions
+ *
+ * The following functions are generated:
+ *
+ * _pd_search_<suffix>(d, prefix) - searches the whole index of dictionary,
+ *   using line offset table if it is available.
+ *
+ * _pd_search_sorted_<suffix>(d, prefixes, n, res) - searches for a batch of
+ *   prefixes, sorted wrt comparison function.
+ */
+
+#define PD_SEARCH_CONCAT2(name, suffix) name##_##suffix
+#define PD_SEARCH_CONCAT(name, suffix) PD_SEARCH_CONCAT2(name, suffix)
+#define PD_SEARCH_FN(name) PD_SEARCH_CONCAT(name, PD_SEARCH_SUFFIX)
+
+static inline int
+PD_SEARCH_FN(_pd_compare)(const char *prefix, const char *line)
+{
+    _pd_search_counters.comparisons++;
+    return PD_SEARCH_CMP((const unsigned char *)prefix,
+                         (const unsigned char *)line);
+}
+
+/*
+ * _find_entry() searches for interval of entries starting with given prefix
+ * ('yr' => 'yraft' .. 'yronne')
+ *
+ * 0. Entries are supposed to be sorted wrt passed comparison function.
+ *
+ * 1. Binary search is performed looking for entry (E) which starts with a given
+ * prefix.
+ *
+ * 1a. If such entry is not found, then there are no entries with given prefix
+ * in dictionary. Empty interval at the place where such entries would be is
+ * returned. Stop.
+ *
+ * 1b. Else, it is known there are matching entries in dictionary, starting
+ * somewhere before found entry and finishing somewhere after (it is probable
+ * that start or end of interval is on entry found).
+ *
+ * 2. First entry (F) that matches given prefix is binary-searched in [start, E)
+ * interval. E is returned if there is no such entry there.
+ *
+ * 3. First entry (L) that does not match given prefix is binary-searched in (E,
+ * end) interval. Such entry is not guaranteed to exist, so "first entry after
+ * the end" may be returned instead.
+ *
+ * 4. [F, L) result is returned.
+ *
+ * Result is returned in "raw" form, that is, just the region in index
+ * file. It's up to a caller to actually parse lines and locate dictionary
+ * articles.
+ */
+
+/*
+ * Returns first line in [start, end) which is not less than prefix, or end.
+ */
+static const char *
+PD_SEARCH_FN(_lower_bound)(const char *prefix, const char *start,
+                           const char *end)
+{
+    while (start < end) {
+        const char *middle = start + (end - start)/2;
+        _pd_search_counters.probes++;
+        /* looking for the start of line */
+        while (middle > start && middle[-1] != '\n') middle--;
+
+        if (PD_SEARCH_FN(_pd_compare)(prefix, middle) > 0)
+            start = _nextline(middle);
+        else
+            end = middle;
+    }
+    return start;
+}
+
+/*
+ * Returns first line in [start, end) which does not match prefix, or end.
+ * Lines in the interval are supposed to be not less than prefix.
+ */
+static const char *
+PD_SEARCH_FN(_upper_bound)(const char *prefix, const char *start,
+                           const char *end)
+{
+    while (start < end) {
+        const char *middle = start + (end - start)/2;
+        _pd_search_counters.probes++;
+        while (middle > start && middle[-1] != '\n') middle--;
+
+        if (PD_SEARCH_FN(_pd_compare)(prefix, middle) == 0)
+            start = _nextline(middle);
+        else
+            end = middle;
+    }
+    return start;
+}
+
+static _pd_interval
+PD_SEARCH_FN(_find_entry)(const char *prefix, const char *start,
+                          const char *end)
+{
+    while (start < end) {
+        const char *middle = start + (end - start)/2;
+        _pd_search_counters.probes++;
+
+        /* looking for the start of line */
+        while (middle > start && middle[-1] != '\n') middle--;
+
+        const char *next = _nextline(middle);
+
+        int c = PD_SEARCH_FN(_pd_compare)(prefix, middle);
+        if (c == 0) {
+            _pd_interval res = {
+                .lower = PD_SEARCH_FN(_lower_bound)(prefix, start, middle),
+                .upper = PD_SEARCH_FN(_upper_bound)(prefix, next, end),
+            };
+            return res;
+        }
+
+        if (c > 0) {
+            start = next;
+        } else {
+            end = middle;
+        }
+    }
+
+    _pd_interval res = { .lower = start, .upper = start };
+    return res;
+}
+
+/*
+ * Same as _find_entry(), but uses line offset table instead of scanning index
+ * text for line boundaries. Entry i starts at index + lines[i], so binary
+ * search is performed over line numbers.
+ */
+
+static size_t
+PD_SEARCH_FN(_lines_lower_bound)(pd_dictionary *d, const char *prefix,
+                                 size_t start, size_t end)
+{
+    while (start < end) {
+        size_t middle = start + (end - start)/2;
+        _pd_search_counters.probes++;
+        if (PD_SEARCH_FN(_pd_compare)(prefix, _line_start(d, middle)) > 0)
+            start = middle + 1;
+        else
+            end = middle;
+    }
+    return start;
+}
+
+static size_t
+PD_SEARCH_FN(_lines_upper_bound)(pd_dictionary *d, const char *prefix,
+                                 size_t start, size_t end)
+{
+    while (start < end) {
+        size_t middle = start + (end - start)/2;
+        _pd_search_counters.probes++;
+        if (PD_SEARCH_FN(_pd_compare)(prefix, _line_start(d, middle)) == 0)
+            start = middle + 1;
+        else
+            end = middle;
+    }
+    return start;
+}
+
+/*
+ * Searches lines [start, end) and stores line numbers of found interval to
+ * lower and upper.
+ */
+static void
+PD_SEARCH_FN(_find_entry_lines)(pd_dictionary *d, const char *prefix,
+                                size_t start, size_t end,
+                                size_t *lower, size_t *upper)
+{
+    while (start < end) {
+        size_t middle = start + (end - start)/2;
+        _pd_search_counters.probes++;
+
+        int c = PD_SEARCH_FN(_pd_compare)(prefix, _line_start(d, middle));
+        if (c == 0) {
+            *lower = PD_SEARCH_FN(_lines_lower_bound)(d, prefix,
+                                                      start, middle);
+            *upper = PD_SEARCH_FN(_lines_upper_bound)(d, prefix,
+                                                      middle + 1, end);
+            return;
+        }
+
+        if (c > 0) {
+            start = middle + 1;
+        } else {
+            end = middle;
+        }
+    }
+
+    *lower = *upper = start;
+}
+
+static _pd_interval
+PD_SEARCH_FN(_pd_search)(pd_dictionary *d, const char *prefix)
+{
+    _pd_interval res;
+    if (d->lines) {
+        size_t lower, upper;
+        PD_SEARCH_FN(_find_entry_lines)(d, prefix, 0, d->line_count,
+                                        &lower, &upper);
+        res.lower = _line_start(d, lower);
+        res.upper = _line_start(d, upper);
+    } else {
+        res = PD_SEARCH_FN(_find_entry)(prefix, d->index,
+                                        d->index + d->index_size);
+    }
+    _pd_search_counters_flush(d);
+    return res;
+}
+
+/*
+ * Entries for each prefix can't be found before entries for previous one, so
+ * the search starts where the previous one has ended. With line offset table
+ * the end of search window is also found by galloping from its start, so
+ * prefixes close to each other cost just a few comparisons.
+ */
+static void
+PD_SEARCH_FN(_pd_search_sorted)(pd_dictionary *d, const char **prefixes,
+                                size_t n, _pd_interval *res)
+{
+    if (d->lines) {
+        size_t start = 0;
+        for (size_t i = 0; i < n; ++i) {
+            size_t end = start;
+            size_t step = 1;
+            while (end < d->line_count) {
+                _pd_search_counters.probes++;
+                int c = PD_SEARCH_FN(_pd_compare)(prefixes[i],
+                                                  _line_start(d, end));
+                if (c < 0)
+                    break;
+                if (c > 0)
+                    start = end + 1;
+                end += step;
+                step *= 2;
+            }
+            if (end > d->line_count)
+                end = d->line_count;
+
+            size_t lower, upper;
+            PD_SEARCH_FN(_find_entry_lines)(d, prefixes[i], start, end,
+                                            &lower, &upper);
+            res[i].lower = _line_start(d, lower);
+            res[i].upper = _line_start(d, upper);
+            start = lower;
+        }
+    } else {
+        const char *start = d->index;
+        const char *end = start + d->index_size;
+        for (size_t i = 0; i < n; ++i) {
+            res[i] = PD_SEARCH_FN(_find_entry)(prefixes[i], start, end);
+            start = res[i].lower;
+        }
+    }
+    _pd_search_counters_flush(d);
+}
+
+#undef PD_SEARCH_FN
+#undef PD_SEARCH_CONCAT
+#undef PD_SEARCH_CONCAT2
+#undef PD_SEARCH_SUFFIX
+#undef PD_SEARCH_CMP
@@ -19,17 +19,35 @@
  */
 
 #include "libpicodict.h"
+#include "libpicodict-pool.h"
 
 #include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/file.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <zlib.h>
+#ifdef HAVE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PD_SIMD_X86
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#define PD_SIMD_NEON
+#include <arm_neon.h>
+#endif
 
 /* Older glibc don't have it */
 #ifndef le16toh
@@ -47,30 +65,150 @@ le16toh(uint16_t arg)
 #endif
 
 
+/* Default size of chunk cache, in chunks */
 #define CHUNK_CACHE_SIZE 3
+/* At most this many chunks are inflated ahead of reading */
+#define PREFETCH_MAX_CHUNKS 16
+/* Lines of result looked at to find out the chunks needed */
+#define PREFETCH_MAX_LINES 256
+/* Requests are dropped if background thread is this much behind */
+#define PREFETCH_MAX_PENDING 4
+/* Default size of chunk store file */
+#define CHUNK_STORE_SIZE (32 * 1024 * 1024)
+/* Threads doing asynchronous lookups of dictionary */
+#define ASYNC_THREADS 2
+#define CHUNK_CACHE_MAX_SHARDS 64
+
+/*
+ * Decompressed chunk. Chunks are identified by serial number of dictionary
+ * and chunk id, and are linked into hash table bucket and into LRU list of
+ * cache shard.
+ *
+ * Chunks are pinned while their data is being used outside of cache lock.
+ * Pinned chunks are never evicted.
+ */
+typedef struct _pd_chunk {
+    struct _pd_chunk *hash_next;
+    struct _pd_chunk *lru_prev;
+    struct _pd_chunk *lru_next;
+    uint64_t dict_serial;
+    int id;
+    int pins;
+    size_t size;
+    char data[];
+} _pd_chunk;
 
+/*
+ * Chunk cache is split into shards by chunk key, each shard is locked
+ * separately, so threads reading different chunks do not contend.
+ *
+ * Every shard keeps at most budget bytes of chunks and evicts least recently
+ * used chunks when it is full.
+ */
 typedef struct {
-    int next_id;
-    int id[CHUNK_CACHE_SIZE];
-    char *data[CHUNK_CACHE_SIZE];
+    pthread_mutex_t lock;
+    _pd_chunk **buckets;
+    size_t bucket_mask;
+    size_t count;
+    _pd_chunk lru; /* list head: lru.lru_next is the most recently used */
+    size_t size;
+    size_t budget;
+
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
 } _pd_chunk_cache;
 
+struct pd_cache {
+    int refcount;
+    size_t shard_count;
+    _pd_chunk_cache shards[];
+};
+
+/*
+ * Decompression state. Every thread reading compressed data takes inflater
+ * from the pool in pd_dictionary for the duration of decompression, so any
+ * number of chunks may be decompressed simultaneously.
+ */
+typedef struct _pd_inflater {
+    struct _pd_inflater *next;
+    void *state; /* decompression engine state */
+} _pd_inflater;
+
 struct pd_dictionary {
     void *index;
     size_t index_size;
 
+    /* Headword trie (optional, see pd_build_trie()) */
+    void *trie_file;
+    size_t trie_file_size;
+    const struct _pd_trie_node *trie;
+    size_t trie_count;
+
+    /* Perfect hash of headwords (optional, see pd_build_perfect_hash()) */
+    void *phash_file;
+    size_t phash_file_size;
+    const uint32_t *phash_pilots;
+    const struct _pd_phash_slot *phash_slots;
+    size_t phash_count;
+
+    /* Bloom filter of headwords (optional, see pd_build_bloom()) */
+    void *bloom_file;
+    size_t bloom_file_size;
+    const uint64_t *bloom;
+    size_t bloom_blocks;
+
+    /* Line offset table (optional, see pd_build_line_table()) */
+    void *lines_file;
+    size_t lines_file_size;
+    uint32_t *lines_allocated; /* built in memory if there is no sidecar */
+    const uint32_t *lines;
+    size_t line_count;
+
+    /*
+     * Normalized headwords (optional, see PICODICT_OPEN_NORMALIZED_KEYS).
+     * Key of line i is keys[key_offsets[i] .. key_offsets[i+1]).
+     */
+    unsigned char *keys;
+    uint32_t *key_offsets;
+
     void *data;
     size_t data_size;
 
     pd_sort_mode mode;
+    /* Comparisons may use _pd_fold_prefix kernel */
+    bool fold_simd;
 
     /* Compressed (.dz) dictionaries */
     bool compressed;
     size_t chunk_length;
     size_t chunk_count;
     size_t *chunk_offsets;
-    z_stream z;
-    _pd_chunk_cache chunk_cache;
+
+    pthread_mutex_t inflaters_lock;
+    _pd_inflater *inflaters;
+
+    uint64_t serial;
+    pd_cache *cache;
+
+    /* Persistent store of chunks (optional, see PICODICT_OPEN_CHUNK_STORE) */
+    struct _pd_chunk_store *store;
+
+    /* Background inflation of chunks (optional, see PICODICT_OPEN_PREFETCH) */
+    bool prefetch;
+    _pd_pool *prefetch_pool;
+    size_t prefetch_chunks;
+    int prefetch_pending;
+    bool closing;
+    /* Threads of asynchronous requests, started on the first one */
+    _pd_pool *async_pool;
+
+    /* Chunk being inflated by prefetch thread, or -1 */
+    pthread_mutex_t prefetch_lock;
+    pthread_cond_t prefetch_done;
+    int prefetch_chunk;
+
+    pd_stats stats;
 };
 
 typedef struct {
@@ -86,41 +224,45 @@ struct pd_result {
     char *article;
     size_t article_length;
     bool article_allocated;
+    /* Cached chunk article points into, if any */
+    _pd_chunk *article_chunk;
+
+    /*
+     * Results of fuzzy search are not contiguous in index: they are listed in
+     * matches, and result is matches->lines[match].
+     */
+    struct _pd_match_list *matches;
+    size_t match;
 };
 
+typedef struct _pd_match_list {
+    int refcount;
+    size_t count;
+    const char *lines[];
+} _pd_match_list;
+
 typedef int (*_pd_cmp)(const char *lhs, const char *rhs);
 
+/* Number of known sort modes, see pd_sort_mode */
+#define SORT_COUNT 4
+
+/*
+ * Statistics counters are updated with relaxed atomic operations, so they are
+ * cheap enough to be always on.
+ */
+#define STAT_ADD(dict, counter, n) \
+    __atomic_fetch_add(&(dict)->stats.counter, (n), __ATOMIC_RELAXED)
+
 /* -- Search -- */
 
 /*
- * _find_entry() searches for interval of entries starting with given prefix
- * ('yr' => 'yraft' .. 'yronne')
- *
- * 0. Entries are supposed to be sorted wrt passed comparison function.
- *
- * 1. Binary search is performed looking for entry (E) which starts with a given
- * prefix.
- *
- * 1a. If such entry is not found, then there are no entries with given prefix
- * in dictionary. Stop.
- *
- * 1b. Else, it is known there are matching entries in dictionary, starting
- * somewhere before found entry and finishing somewhere after (it is probable
- * that start or end of interval is on entry found).
- *
- * 2. First entry (F) that matches given prefix is binary-searched in [start, E]
- * interval. It is known that such entry exists.
- *
- * 3. First entry (L) that does not match given prefix is binary-searched in (E,
- * end] interval. Such entry is not guaranteed to exist, so "first entry after
- * the end" may be returned instead.
- *
- * 4. [F, L) result is returned.
- *
- * Result is returned in "raw" form, that is, just the region in index
- * file. It's up to a caller to actually parse lines and locate dictionary
- * articles.
+ * Search functions count probes and comparisons in thread-local counters,
+ * which are added to dictionary statistics once search is finished.
  */
+static __thread struct {
+    unsigned long probes;
+    unsigned long comparisons;
+} _pd_search_counters;
 
 /*
  * Check whether str starts with prefix
@@ -228,680 +370,4493 @@ _pd_strdictcmp(const unsigned char *lhs, const unsigned char *rhs)
     }
 }
 
-static const char *
-_nextline(const char *c)
-{
-    return strchr(c, '\n') + 1;
-}
-
-static const char *
-_lower_bound(_pd_cmp cmp, const char *prefix, const char *start, const char *end)
-{
-    const char *middle = start + (end - start)/2;
-    /* looking for the start of line */
-    while (middle > start && middle[-1] != '\n') middle--;
-
-    const char *next = _nextline(middle);
+/*
+ * Comparison functions for UTF-8 sort modes. Characters are folded with
+ * Unicode simple case folding and compared as UTF-8 byte sequences, which is
+ * the same as comparing folded code points. Bytes not forming valid UTF-8
+ * sequences are compared as is.
+ */
 
-    /* If we've got a single line, then we've found it */
-    if (middle == start && next == end)
-        return middle;
+#include "libpicodict-casefold.h"
 
-    int c = (*cmp)(prefix, middle);
-    if (c > 0)
-        return _lower_bound(cmp, prefix, next, end);
+static uint32_t
+_pd_casefold(uint32_t c)
+{
+    if (c < 0x80)
+        return c >= 'A' && c <= 'Z' ? c + 0x20 : c;
+
+    size_t lo = 0;
+    size_t hi = sizeof(_pd_casefold_ranges) / sizeof(_pd_casefold_ranges[0]);
+    while (lo < hi) {
+        size_t middle = lo + (hi - lo)/2;
+        if (_pd_casefold_ranges[middle].last < c)
+            lo = middle + 1;
+        else
+            hi = middle;
+    }
 
-    /* Check that middle is not last line. Without this check we'd go into
-     * infinite loop, as we'd call ourself with the same arguments. To avoid
-     * this situation, either terminate search or call itself again without last
-     * line.
-     */
-    if (next == end) {
-         const char *prevline = middle - 1; /* skip \n on previous line */
-         while (prevline > start && prevline[-1] != '\n') prevline--;
+    if (lo < sizeof(_pd_casefold_ranges) / sizeof(_pd_casefold_ranges[0])
+        && _pd_casefold_ranges[lo].first <= c
+        && (c - _pd_casefold_ranges[lo].first)
+               % _pd_casefold_ranges[lo].stride == 0)
+        return c + _pd_casefold_ranges[lo].delta;
+    return c;
+}
 
-         /*
-          * Now check if prevline matches prefix. If it is, then drop last line,
-          * else we've found lower bound
-          */
-         int c = (*cmp)(prefix, prevline);
-         if (c > 0)
-             return middle;
+/*
+ * Decodes UTF-8 sequence at s. Returns its length, or 0 if there is no valid
+ * sequence. Terminators are not continuation bytes, so decoding never goes
+ * past the end of string.
+ */
+static unsigned
+_pd_utf8_decode(const unsigned char *s, uint32_t *c)
+{
+    unsigned n;
+    uint32_t min;
+    if ((s[0] & 0xe0) == 0xc0) {
+        n = 2; min = 0x80; *c = s[0] & 0x1f;
+    } else if ((s[0] & 0xf0) == 0xe0) {
+        n = 3; min = 0x800; *c = s[0] & 0x0f;
+    } else if ((s[0] & 0xf8) == 0xf0) {
+        n = 4; min = 0x10000; *c = s[0] & 0x07;
+    } else {
+        return 0;
+    }
 
-         return _lower_bound(cmp, prefix, start, middle);
+    for (unsigned i = 1; i < n; ++i) {
+        if ((s[i] & 0xc0) != 0x80)
+            return 0;
+        *c = (*c << 6) | (s[i] & 0x3f);
     }
 
-    return _lower_bound(cmp, prefix, start, next);
+    /* Overlong sequences, surrogates and out-of-range code points */
+    if (*c < min || (*c >= 0xd800 && *c < 0xe000) || *c > 0x10ffff)
+        return 0;
+    return n;
 }
 
-static const char *
-_upper_bound(_pd_cmp cmp, const char *prefix, const char *start, const char *end)
+static unsigned
+_pd_utf8_encode(uint32_t c, unsigned char *out)
 {
-    if (start == end)
-        return start;
+    if (c < 0x80) {
+        out[0] = c;
+        return 1;
+    }
+    if (c < 0x800) {
+        out[0] = 0xc0 | (c >> 6);
+        out[1] = 0x80 | (c & 0x3f);
+        return 2;
+    }
+    if (c < 0x10000) {
+        out[0] = 0xe0 | (c >> 12);
+        out[1] = 0x80 | ((c >> 6) & 0x3f);
+        out[2] = 0x80 | (c & 0x3f);
+        return 3;
+    }
+    out[0] = 0xf0 | (c >> 18);
+    out[1] = 0x80 | ((c >> 12) & 0x3f);
+    out[2] = 0x80 | ((c >> 6) & 0x3f);
+    out[3] = 0x80 | (c & 0x3f);
+    return 4;
+}
 
-    const char *middle = start + (end - start)/2;
-    while (middle > start && middle[-1] != '\n') middle--;
+/*
+ * Folds character at *s and advances *s past it. Folded character is written
+ * to out, and its length is returned. Folded character may be longer than
+ * original one, but no more than 1.5 times.
+ */
+static unsigned
+_pd_fold_char(const unsigned char **s, unsigned char *out)
+{
+    const unsigned char *p = *s;
+    uint32_t c;
+    unsigned n;
+
+    if (*p < 0x80) {
+        *out = *p >= 'A' && *p <= 'Z' ? *p + 0x20 : *p;
+        n = 1;
+    } else if ((n = _pd_utf8_decode(p, &c))) {
+        *s = p + n;
+        return _pd_utf8_encode(_pd_casefold(c), out);
+    } else {
+        *out = *p;
+        n = 1;
+    }
+    *s = p + n;
+    return 1;
+}
 
-    const char *next = _nextline(middle);
+/*
+ * Folded string, read byte by byte.
+ */
+typedef struct {
+    const unsigned char *str;
+    unsigned char buf[4];
+    unsigned pos;
+    unsigned len;
+} _pd_fold_stream;
 
-    int c = (*cmp)(prefix, middle);
-    if (c == 0)
-        return _upper_bound(cmp, prefix, next, end);
+static bool
+_pd_is_unalpha(unsigned char c)
+{
+    /* UTF-8 is assumed */
+    return c && c < 0x80 && !isblank(c) && !isalnum(c);
+}
 
-    /*
-     * Check that middle is not a last line. Without this check we'd go into
-     * infinite loop. To avoid this situation either terminate search or call
-     * itself without last line.
-     */
-    if (next == end) {
-        const char* prevline = middle - 1; /* skip \n on previous line */
-        while (prevline > start && prevline[-1] != '\n') prevline--;
+/*
+ * Returns next byte of folded string, or -1 at the end of string: '\0' or,
+ * if tab_ends is set, '\t'.
+ */
+static inline int
+_pd_fold_next(_pd_fold_stream *fs, bool skip_unalpha, bool tab_ends)
+{
+    if (fs->pos < fs->len)
+        return fs->buf[fs->pos++];
 
-        int c = (*cmp)(prefix, prevline);
-        if (c == 0)
-            return middle;
+    if (skip_unalpha)
+        while (_pd_is_unalpha(*fs->str))
+            fs->str++;
 
-        return _upper_bound(cmp, prefix, start, middle);
-    }
+    if (!*fs->str || (tab_ends && *fs->str == '\t'))
+        return -1;
 
-    return _upper_bound(cmp, prefix, start, next);
+    fs->len = _pd_fold_char(&fs->str, fs->buf);
+    fs->pos = 1;
+    return fs->buf[0];
 }
 
-static _pd_interval
-_find_entry(_pd_cmp cmp, const char *prefix, const char *start, const char *end)
+static inline int
+_pd_utf8cmp(const unsigned char *lhs, const unsigned char *rhs,
+            bool skip_unalpha)
 {
-    _pd_interval res = {};
-
-    while (start < end) {
-        const char *middle = start + (end - start)/2;
-
-        /* looking for the start of line */
-        while (middle > start && middle[-1] != '\n') middle--;
+    _pd_fold_stream l = { .str = lhs };
+    _pd_fold_stream r = { .str = rhs };
+    for (;;) {
+        int lc = _pd_fold_next(&l, skip_unalpha, true);
+        int rc = _pd_fold_next(&r, skip_unalpha, true);
+        if (lc != rc)
+            return lc < rc ? -1 : 1;
+        if (lc < 0)
+            return 0;
+    }
+}
 
-        const char *next = _nextline(middle);
+static inline int
+_pd_utf8prefixcmp(const unsigned char *prefix, const unsigned char *str,
+                  bool skip_unalpha)
+{
+    _pd_fold_stream p = { .str = prefix };
+    _pd_fold_stream s = { .str = str };
+    for (;;) {
+        int pc = _pd_fold_next(&p, skip_unalpha, false);
+        if (pc < 0)
+            return 0;
+        int sc = _pd_fold_next(&s, skip_unalpha, true);
+        if (sc < 0)
+            return 1;
+        if (pc != sc)
+            return pc < sc ? -1 : 1;
+    }
+}
 
-        int c = (*cmp)(prefix, middle);
-        if (c == 0) {
-            res.lower = _lower_bound(cmp, prefix, start, next);
-            res.upper = _upper_bound(cmp, prefix, next, end);
-            break;
-        }
+static int
+_pd_strcasecmp_utf8(const unsigned char *lhs, const unsigned char *rhs)
+{
+    return _pd_utf8cmp(lhs, rhs, false);
+}
 
-        if (c > 0) {
-            start = next;
-        } else {
-            end = middle;
-        }
-    }
+static int
+_pd_strprefixcasecmp_utf8(const unsigned char *prefix,
+                          const unsigned char *str)
+{
+    return _pd_utf8prefixcmp(prefix, str, false);
+}
 
-    return res;
+static int
+_pd_strdictcmp_utf8(const unsigned char *lhs, const unsigned char *rhs)
+{
+    return _pd_utf8cmp(lhs, rhs, true);
 }
 
-/* -- Dictionary manipulation -- */
+static int
+_pd_strprefixdictcmp_utf8(const unsigned char *prefix,
+                          const unsigned char *str)
+{
+    return _pd_utf8prefixcmp(prefix, str, true);
+}
 
 /*
- * Format of dict.dz file.
+ * Vectorized versions of _pd_strcasecmp() and _pd_strprefixcasecmp().
  *
- * Gzip header:
- *
- *       +---+---+---+---+---+---+---+---+---+---+
- *       |ID1|ID2|CM |FLG|     MTIME     |XFL|OS | (more-->)
- *       +---+---+---+---+---+---+---+---+---+---+
- *
- *    (if FLG.FEXTRA set)
- *
- *       +---+---+=================================+
- *       | XLEN  |...XLEN bytes of "extra field"...| (more-->)
- *       +---+---+=================================+
- *
- *    (if FLG.FNAME set)
- *
- *       +=========================================+
- *       |...original file name, zero-terminated...| (more-->)
- *       +=========================================+
- *
- *    (if FLG.FCOMMENT set)
- *
- *       +===================================+
- *       |...file comment, zero-terminated...| (more-->)
- *       +===================================+
- *
- *    (if FLG.FHCRC set)
- *
- *       +---+---+
- *       | CRC16 |
- *       +---+---+
- *
- * Data:
- *
- *       +=======================+
- *       |...compressed blocks...| (more-->)
- *       +=======================+
- *
- * Footer:
- *
- *         0   1   2   3   4   5   6   7
- *       +---+---+---+---+---+---+---+---+
- *       |     CRC32     |     ISIZE     |
- *       +---+---+---+---+---+---+---+---+
- *
- * Format of extra dz field (FLG.EXTRA):
- *
- *      +---+---+---+---+---+---+---+---+---+---+---+---+
- *      | XLEN  |SI1|SI2| SLEN  | SVER  | CHLEN | CHCNT | (more-->)
- *      +---+---+---+---+---+---+---+---+---+---+---+---+
- *      +================================================+
- *      |...CHCNT chunk compressed sizes, 2 bytes each...|
- *      +================================================+
- *
- * where
- *
- *      SI1 = 'R', 0x52
- *      SI2 = 'A', 0x41
- *      SLEN = XLEN - 4
- *      SVER = 1
- *
- *      CHLEN is a size of unpacked chunk.
- *      CHCNT is count of chunks in file
+ * Kernel skips the common part of two strings 16 or 32 bytes at a time: bytes
+ * equal after folding ASCII case, up to the first '\0' or '\t' in lhs. The
+ * rest is compared by the scalar functions, which remain the reference
+ * implementation.
  *
- *      Sizes of compressed chunks follow from first to CHCNT one.
+ * Kernels fold only ASCII letters, so they are used only if tolower() does
+ * the same, as it does in C locale and in UTF-8 ones. This is checked in the
+ * locale active when dictionary is opened.
  *
- *      Each chunk can be decompressed individually.
+ * Vectors are loaded past the end of strings, so loads are never allowed to
+ * cross page boundary. Bytes past the end may belong to other allocations,
+ * possibly being written by other threads: they never affect the result, so
+ * kernels are not instrumented by sanitizers.
  */
 
-enum {
-    GZIP_ID1 = 0x1f,
-    GZIP_ID2 = 0x8b,
+#define PD_MIN_PAGE_SIZE 4096
 
-    GZIP_FTEXT = 1,
-    GZIP_FHCRC = 2,
-    GZIP_FEXTRA = 4,
-    GZIP_FNAME = 8,
-    GZIP_FCOMMENT = 16,
+static bool
+_pd_page_safe(const unsigned char *p, size_t n)
+{
+    return ((uintptr_t)p & (PD_MIN_PAGE_SIZE - 1)) <= PD_MIN_PAGE_SIZE - n;
+}
 
-    DZIP_SI1 = 0x52,
-    DZIP_SI2 = 0x41,
-};
+typedef size_t (*_pd_fold_prefix_fn)(const unsigned char *lhs,
+                                     const unsigned char *rhs);
 
-typedef enum {
-    DZ_NOT_FOUND = -1,
-    DZ_OK,
-    DZ_ERROR,
-} dz_parse_result;
+/* NULL if CPU has no suitable kernel */
+static _pd_fold_prefix_fn _pd_fold_prefix;
+static pthread_once_t _pd_fold_prefix_once = PTHREAD_ONCE_INIT;
 
-static dz_parse_result
-_parse_dz_header(pd_dictionary *dict, const unsigned char *file, size_t size)
+#ifdef PD_SIMD_X86
+__attribute__((target("sse2"), no_sanitize_address, no_sanitize_thread))
+static size_t
+_pd_fold_prefix_sse2(const unsigned char *lhs, const unsigned char *rhs)
 {
-    if (size < 12)
-        return DZ_NOT_FOUND;
-
-    int compression = file[2];
-    int flags = file[3];
-    unsigned xlen = le16toh(*(unsigned short *)(file + 10));
+    /* c - ('A' + 128) is less than -128 + 26 (signed) iff c is 'A'..'Z' */
+    const __m128i bias = _mm_set1_epi8((char)('A' + 128));
+    const __m128i limit = _mm_set1_epi8(-128 + 26);
+    const __m128i bit = _mm_set1_epi8(0x20);
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i zero = _mm_setzero_si128();
+
+    size_t n = 0;
+    while (_pd_page_safe(lhs + n, 16) && _pd_page_safe(rhs + n, 16)) {
+        __m128i l = _mm_loadu_si128((const __m128i *)(lhs + n));
+        __m128i r = _mm_loadu_si128((const __m128i *)(rhs + n));
+
+        __m128i lu = _mm_cmplt_epi8(_mm_sub_epi8(l, bias), limit);
+        __m128i ru = _mm_cmplt_epi8(_mm_sub_epi8(r, bias), limit);
+        l = _mm_or_si128(l, _mm_and_si128(lu, bit));
+        r = _mm_or_si128(r, _mm_and_si128(ru, bit));
+
+        __m128i end = _mm_or_si128(_mm_cmpeq_epi8(l, zero),
+                                   _mm_cmpeq_epi8(l, tab));
+        unsigned same = _mm_movemask_epi8(
+            _mm_andnot_si128(end, _mm_cmpeq_epi8(l, r)));
+        if (same != 0xffff)
+            return n + __builtin_ctz(~same);
+        n += 16;
+    }
+    return n;
+}
 
-    /* Basic info */
+__attribute__((target("avx2"), no_sanitize_address, no_sanitize_thread))
+static size_t
+_pd_fold_prefix_avx2(const unsigned char *lhs, const unsigned char *rhs)
+{
+    const __m256i bias = _mm256_set1_epi8((char)('A' + 128));
+    const __m256i limit = _mm256_set1_epi8(-128 + 26);
+    const __m256i bit = _mm256_set1_epi8(0x20);
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i zero = _mm256_setzero_si256();
+
+    size_t n = 0;
+    while (_pd_page_safe(lhs + n, 32) && _pd_page_safe(rhs + n, 32)) {
+        __m256i l = _mm256_loadu_si256((const __m256i *)(lhs + n));
+        __m256i r = _mm256_loadu_si256((const __m256i *)(rhs + n));
+
+        __m256i lu = _mm256_cmpgt_epi8(limit, _mm256_sub_epi8(l, bias));
+        __m256i ru = _mm256_cmpgt_epi8(limit, _mm256_sub_epi8(r, bias));
+        l = _mm256_or_si256(l, _mm256_and_si256(lu, bit));
+        r = _mm256_or_si256(r, _mm256_and_si256(ru, bit));
+
+        __m256i end = _mm256_or_si256(_mm256_cmpeq_epi8(l, zero),
+                                      _mm256_cmpeq_epi8(l, tab));
+        unsigned same = _mm256_movemask_epi8(
+            _mm256_andnot_si256(end, _mm256_cmpeq_epi8(l, r)));
+        if (same != 0xffffffff)
+            return n + __builtin_ctz(~same);
+        n += 32;
+    }
 
-    if (file[0] != GZIP_ID1 || file[1] != GZIP_ID2 || compression != 8)
-        return DZ_NOT_FOUND;
+    /* Tail near page boundary */
+    return n + _pd_fold_prefix_sse2(lhs + n, rhs + n);
+}
+#endif
 
-    /* 'extra' field */
+#ifdef PD_SIMD_NEON
+__attribute__((no_sanitize_address, no_sanitize_thread))
+static size_t
+_pd_fold_prefix_neon(const unsigned char *lhs, const unsigned char *rhs)
+{
+    const uint8x16_t a = vdupq_n_u8('A');
+    const uint8x16_t letters = vdupq_n_u8(26);
+    const uint8x16_t bit = vdupq_n_u8(0x20);
+    const uint8x16_t tab = vdupq_n_u8('\t');
+    const uint8x16_t zero = vdupq_n_u8(0);
+
+    size_t n = 0;
+    while (_pd_page_safe(lhs + n, 16) && _pd_page_safe(rhs + n, 16)) {
+        uint8x16_t l = vld1q_u8(lhs + n);
+        uint8x16_t r = vld1q_u8(rhs + n);
+
+        l = vorrq_u8(l, vandq_u8(vcltq_u8(vsubq_u8(l, a), letters), bit));
+        r = vorrq_u8(r, vandq_u8(vcltq_u8(vsubq_u8(r, a), letters), bit));
+
+        uint8x16_t end = vorrq_u8(vceqq_u8(l, zero), vceqq_u8(l, tab));
+        uint8x16_t same = vbicq_u8(vceqq_u8(l, r), end);
+
+        /* There is no movemask: find out whether all lanes are set */
+        uint8x8_t m = vand_u8(vget_low_u8(same), vget_high_u8(same));
+        m = vpmin_u8(m, m);
+        m = vpmin_u8(m, m);
+        m = vpmin_u8(m, m);
+        if (vget_lane_u8(m, 0) != 0xff)
+            break;
+        n += 16;
+    }
+    return n;
+}
+#endif
 
-    if (!(flags & GZIP_FEXTRA))
-        return DZ_ERROR;
+static void
+_pd_fold_prefix_init(void)
+{
+#if defined(PD_SIMD_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        _pd_fold_prefix = _pd_fold_prefix_avx2;
+    else if (__builtin_cpu_supports("sse2"))
+        _pd_fold_prefix = _pd_fold_prefix_sse2;
+#elif defined(PD_SIMD_NEON)
+    _pd_fold_prefix = _pd_fold_prefix_neon;
+#endif
+}
 
-    if (size < 12 + xlen)
-        return DZ_ERROR;
+/*
+ * Checks whether tolower() of current locale folds ASCII letters only.
+ */
+static bool
+_pd_locale_folds_ascii(void)
+{
+    for (int c = 0; c < 256; ++c)
+        if (tolower(c) != (c >= 'A' && c <= 'Z' ? c + 0x20 : c))
+            return false;
+    return true;
+}
 
-    if (file[12] != DZIP_SI1 || file[13] != DZIP_SI2)
-        return DZ_ERROR;
+static int
+_pd_strprefixcasecmp_simd(const unsigned char *prefix, const unsigned char *str)
+{
+    size_t n = _pd_fold_prefix(prefix, str);
+    return _pd_strprefixcasecmp(prefix + n, str + n);
+}
 
-    unsigned slen = le16toh(*(unsigned short *)(file + 14));
-    if (slen != xlen - 4)
+static int
+_pd_strcasecmp_simd(const unsigned char *lhs, const unsigned char *rhs)
+{
+    size_t n = _pd_fold_prefix(lhs, rhs);
+    return _pd_strcasecmp(lhs + n, rhs + n);
+}
+
+static const char *
+_nextline(const char *c)
+{
+    return strchr(c, '\n') + 1;
+}
+
+static const char *
+_line_start(pd_dictionary *d, size_t i)
+{
+    if (i == d->line_count)
+        return (const char *)d->index + d->index_size;
+    return (const char *)d->index + d->lines[i];
+}
+
+static void
+_pd_search_counters_flush(pd_dictionary *d)
+{
+    STAT_ADD(d, probes, _pd_search_counters.probes);
+    STAT_ADD(d, comparisons, _pd_search_counters.comparisons);
+    _pd_search_counters.probes = 0;
+    _pd_search_counters.comparisons = 0;
+}
+
+/*
+ * Search functions are generated from libpicodict-search.h for every
+ * comparison function, so comparisons are direct calls the compiler is free
+ * to inline, instead of calls through _pd_cmp pointer on every probe.
+ */
+
+#define PD_SEARCH_CMP _pd_strcasecmp
+#define PD_SEARCH_SUFFIX casecmp
+#include "libpicodict-search.h"
+
+#define PD_SEARCH_CMP _pd_strprefixcasecmp
+#define PD_SEARCH_SUFFIX prefixcasecmp
+#include "libpicodict-search.h"
+
+#define PD_SEARCH_CMP _pd_strdictcmp
+#define PD_SEARCH_SUFFIX dictcmp
+#include "libpicodict-search.h"
+
+#define PD_SEARCH_CMP _pd_strprefixdictcmp
+#define PD_SEARCH_SUFFIX prefixdictcmp
+#include "libpicodict-search.h"
+
+#define PD_SEARCH_CMP _pd_strcasecmp_utf8
+#define PD_SEARCH_SUFFIX casecmp_utf8
+#include "libpicodict-search.h"
+
+#define PD_SEARCH_CMP _pd_strprefixcasecmp_utf8
+#define PD_SEARCH_SUFFIX prefixcasecmp_utf8
+#include "libpicodict-search.h"
+
+#define PD_SEARCH_CMP _pd_strdictcmp_utf8
+#define PD_SEARCH_SUFFIX dictcmp_utf8
+#include "libpicodict-search.h"
+
+#define PD_SEARCH_CMP _pd_strprefixdictcmp_utf8
+#define PD_SEARCH_SUFFIX prefixdictcmp_utf8
+#include "libpicodict-search.h"
+
+#define PD_SEARCH_CMP _pd_strcasecmp_simd
+#define PD_SEARCH_SUFFIX casecmp_simd
+#include "libpicodict-search.h"
+
+#define PD_SEARCH_CMP _pd_strprefixcasecmp_simd
+#define PD_SEARCH_SUFFIX prefixcasecmp_simd
+#include "libpicodict-search.h"
+
+/*
+ * Search functions for given sort and find modes.
+ */
+typedef struct {
+    /* Searches the whole index for prefix */
+    _pd_interval (*search)(pd_dictionary *d, const char *prefix);
+    /* Searches for n prefixes, sorted wrt comparison function */
+    void (*search_sorted)(pd_dictionary *d, const char **prefixes, size_t n,
+                          _pd_interval *res);
+    /* Searches lines in [start, end) for prefix */
+    _pd_interval (*search_range)(const char *prefix, const char *start,
+                                 const char *end);
+    _pd_cmp cmp;
+} _pd_searcher;
+
+#define PD_SEARCHER(suffix, cmp)                                     \
+    { _pd_search_##suffix, _pd_search_sorted_##suffix,               \
+      _find_entry_##suffix, (_pd_cmp)cmp }
+
+/* Indexed by sort mode and find mode */
+static const _pd_searcher _pd_searchers[SORT_COUNT][2] = {
+    [PICODICT_SORT_ALPHABET] = {
+        [PICODICT_FIND_EXACT] = PD_SEARCHER(casecmp, _pd_strcasecmp),
+        [PICODICT_FIND_STARTS_WITH] =
+            PD_SEARCHER(prefixcasecmp, _pd_strprefixcasecmp),
+    },
+    [PICODICT_SORT_SKIPUNALPHA] = {
+        [PICODICT_FIND_EXACT] = PD_SEARCHER(dictcmp, _pd_strdictcmp),
+        [PICODICT_FIND_STARTS_WITH] =
+            PD_SEARCHER(prefixdictcmp, _pd_strprefixdictcmp),
+    },
+    [PICODICT_SORT_ALPHABET_UTF8] = {
+        [PICODICT_FIND_EXACT] =
+            PD_SEARCHER(casecmp_utf8, _pd_strcasecmp_utf8),
+        [PICODICT_FIND_STARTS_WITH] =
+            PD_SEARCHER(prefixcasecmp_utf8, _pd_strprefixcasecmp_utf8),
+    },
+    [PICODICT_SORT_SKIPUNALPHA_UTF8] = {
+        [PICODICT_FIND_EXACT] =
+            PD_SEARCHER(dictcmp_utf8, _pd_strdictcmp_utf8),
+        [PICODICT_FIND_STARTS_WITH] =
+            PD_SEARCHER(prefixdictcmp_utf8, _pd_strprefixdictcmp_utf8),
+    },
+};
+
+/* Replace PICODICT_SORT_ALPHABET ones if there is vectorized kernel */
+static const _pd_searcher _pd_searchers_simd[2] = {
+    [PICODICT_FIND_EXACT] = PD_SEARCHER(casecmp_simd, _pd_strcasecmp_simd),
+    [PICODICT_FIND_STARTS_WITH] =
+        PD_SEARCHER(prefixcasecmp_simd, _pd_strprefixcasecmp_simd),
+};
+
+/* -- Normalized keys -- */
+
+/*
+ * Comparison functions fold case and skip non-alphanumerics on every byte of
+ * every probe. With normalized keys this is done once: for every headword on
+ * opening and for the query once per lookup. Normalized strings sort in the
+ * same order as the original ones do wrt comparison function of the sort
+ * mode, so plain memcmp() is enough during search.
+ */
+
+/*
+ * Returns offsets of starts of all lines of index, or NULL if index is empty,
+ * too big or not terminated by newline.
+ */
+static uint32_t *
+_pd_line_offsets(const char *index, size_t index_size, size_t *count)
+{
+    /* Offsets are 32-bit */
+    if (index_size == 0 || index_size > UINT32_MAX
+        || index[index_size - 1] != '\n')
+        return NULL;
+
+    size_t n = 0;
+    for (const char *c = index; c < index + index_size; c++)
+        if (*c == '\n')
+            n++;
+
+    uint32_t *lines = malloc(n * sizeof(uint32_t));
+    if (!lines)
+        return NULL;
+
+    const char *c = index;
+    for (size_t i = 0; i < n; ++i) {
+        lines[i] = c - index;
+        c = memchr(c, '\n', index + index_size - c) + 1;
+    }
+
+    *count = n;
+    return lines;
+}
+
+/*
+ * Folds len bytes of str the same way comparison functions of sort mode do.
+ * Writes at most PD_NORMALIZED_MAX(len) bytes to out and returns length of
+ * normalized string.
+ */
+
+#define PD_NORMALIZED_MAX(len) ((len) + (len) / 2)
+
+static size_t
+_pd_normalize(pd_sort_mode mode, const unsigned char *str, size_t len,
+              unsigned char *out)
+{
+    unsigned char *o = out;
+    const unsigned char *end = str + len;
+
+    if (mode == PICODICT_SORT_ALPHABET_UTF8
+        || mode == PICODICT_SORT_SKIPUNALPHA_UTF8) {
+        while (str < end) {
+            if (mode == PICODICT_SORT_SKIPUNALPHA_UTF8 && _pd_is_unalpha(*str))
+                str++;
+            else
+                o += _pd_fold_char(&str, o);
+        }
+        return o - out;
+    }
+
+    for (; str < end; str++) {
+        /* UTF-8 is assumed */
+        if (mode == PICODICT_SORT_SKIPUNALPHA && *str < 0x80
+            && !isblank(*str) && !isalnum(*str))
+            continue;
+        *o++ = tolower(*str);
+    }
+    return o - out;
+}
+
+/*
+ * Normalizes headwords of all count lines of index, starting at given
+ * offsets. Stores keys to allocated *keys and returns allocated offsets of
+ * keys: key of line i is (*keys)[offsets[i] .. offsets[i+1]). Returns NULL if
+ * memory can't be allocated or keys don't fit 32-bit offsets (keys may be
+ * longer than headwords).
+ */
+static uint32_t *
+_pd_normalize_index(pd_sort_mode mode, const char *index, size_t index_size,
+                    const uint32_t *lines, size_t count, unsigned char **keys)
+{
+    uint32_t *key_offsets = malloc((count + 1) * sizeof(uint32_t));
+    unsigned char *k = malloc(PD_NORMALIZED_MAX(index_size));
+    if (!key_offsets || !k) {
+        free(key_offsets);
+        free(k);
+        return NULL;
+    }
+
+    size_t size = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const char *line = index + lines[i];
+        const char *end = i + 1 < count ? index + lines[i + 1]
+                                        : index + index_size;
+        const char *tab = memchr(line, '\t', end - line);
+        if (tab)
+            end = tab;
+
+        key_offsets[i] = size;
+        size += _pd_normalize(mode, (const unsigned char *)line, end - line,
+                              k + size);
+        if (size > UINT32_MAX) {
+            free(key_offsets);
+            free(k);
+            return NULL;
+        }
+    }
+    key_offsets[count] = size;
+
+    /* Buffer was sized for the whole index, not just headwords */
+    unsigned char *shrunk = realloc(k, size ? size : 1);
+    *keys = shrunk ? shrunk : k;
+    return key_offsets;
+}
+
+/*
+ * Checks that count normalized keys are sorted.
+ */
+static bool
+_pd_keys_sorted(const unsigned char *keys, const uint32_t *key_offsets,
+                size_t count)
+{
+    for (size_t i = 1; i < count; ++i) {
+        size_t prev_len = key_offsets[i] - key_offsets[i - 1];
+        size_t len = key_offsets[i + 1] - key_offsets[i];
+        int c = memcmp(keys + key_offsets[i - 1], keys + key_offsets[i],
+                       prev_len < len ? prev_len : len);
+        if (c > 0 || (c == 0 && prev_len > len))
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Keys are optional, like sidecars: if they can't be built, dictionary is
+ * searched without them.
+ */
+static void
+_pd_build_keys(pd_dictionary *dict)
+{
+    if (!dict->lines) {
+        dict->lines_allocated = _pd_line_offsets(dict->index, dict->index_size,
+                                                 &dict->line_count);
+        if (!dict->lines_allocated)
+            return;
+        dict->lines = dict->lines_allocated;
+    }
+
+    dict->key_offsets = _pd_normalize_index(dict->mode, dict->index,
+                                            dict->index_size, dict->lines,
+                                            dict->line_count, &dict->keys);
+}
+
+static void
+_pd_free_keys(pd_dictionary *dict)
+{
+    free(dict->keys);
+    free(dict->key_offsets);
+    free(dict->lines_allocated);
+}
+
+/*
+ * Compares normalized query with key of line i. In PICODICT_FIND_STARTS_WITH
+ * mode keys starting with query are equal to it.
+ */
+static int
+_pd_key_compare(pd_dictionary *d, const unsigned char *query, size_t len,
+                pd_find_mode options, size_t i)
+{
+    _pd_search_counters.comparisons++;
+
+    const unsigned char *key = d->keys + d->key_offsets[i];
+    size_t key_len = d->key_offsets[i + 1] - d->key_offsets[i];
+
+    int c = memcmp(query, key, len < key_len ? len : key_len);
+    if (c)
+        return c;
+    if (len == key_len)
+        return 0;
+    if (len < key_len)
+        return options == PICODICT_FIND_STARTS_WITH ? 0 : -1;
+    return 1;
+}
+
+/*
+ * Searches lines [start, end) for keys matching normalized query and stores
+ * line numbers of found interval to lower and upper. Works the same way as
+ * _find_entry_lines().
+ */
+static void
+_pd_find_key(pd_dictionary *d, const unsigned char *query, size_t len,
+             pd_find_mode options, size_t start, size_t end,
+             size_t *lower, size_t *upper)
+{
+    while (start < end) {
+        size_t middle = start + (end - start)/2;
+        _pd_search_counters.probes++;
+
+        int c = _pd_key_compare(d, query, len, options, middle);
+        if (c == 0) {
+            size_t lo = start, hi = middle;
+            while (lo < hi) {
+                size_t m = lo + (hi - lo)/2;
+                _pd_search_counters.probes++;
+                if (_pd_key_compare(d, query, len, options, m) > 0)
+                    lo = m + 1;
+                else
+                    hi = m;
+            }
+            *lower = lo;
+
+            lo = middle + 1, hi = end;
+            while (lo < hi) {
+                size_t m = lo + (hi - lo)/2;
+                _pd_search_counters.probes++;
+                if (_pd_key_compare(d, query, len, options, m) == 0)
+                    lo = m + 1;
+                else
+                    hi = m;
+            }
+            *upper = lo;
+            return;
+        }
+
+        if (c > 0)
+            start = middle + 1;
+        else
+            end = middle;
+    }
+
+    *lower = *upper = start;
+}
+
+/*
+ * Normalizes query into buf if it fits, or into allocated memory otherwise.
+ * Exact queries end at tab, as headwords in index do. Returns NULL if memory
+ * can't be allocated.
+ */
+static unsigned char *
+_pd_normalize_query(pd_dictionary *d, const char *text, pd_find_mode options,
+                    unsigned char *buf, size_t buf_size, size_t *len)
+{
+    size_t text_len = options == PICODICT_FIND_EXACT ? strcspn(text, "\t")
+                                                     : strlen(text);
+    size_t size = PD_NORMALIZED_MAX(text_len);
+    unsigned char *query = size <= buf_size ? buf : malloc(size);
+    if (query)
+        *len = _pd_normalize(d->mode, (const unsigned char *)text, text_len,
+                             query);
+    return query;
+}
+
+/*
+ * Same as search_sorted of _pd_searcher, but uses normalized keys. All texts should be
+ * sorted wrt exact comparison function of sort mode.
+ */
+static void
+_pd_search_keys(pd_dictionary *d, const char **texts, size_t n,
+                pd_find_mode options, _pd_interval *res)
+{
+    unsigned char buf[256];
+    size_t start = 0;
+    for (size_t i = 0; i < n; ++i) {
+        size_t len;
+        unsigned char *query = _pd_normalize_query(d, texts[i], options,
+                                                   buf, sizeof(buf), &len);
+        if (!query) {
+            res[i].lower = res[i].upper = _line_start(d, start);
+            continue;
+        }
+
+        size_t lower, upper;
+        _pd_find_key(d, query, len, options, start, d->line_count,
+                     &lower, &upper);
+        res[i].lower = _line_start(d, lower);
+        res[i].upper = _line_start(d, upper);
+        start = lower;
+
+        if (query != buf)
+            free(query);
+    }
+    _pd_search_counters_flush(d);
+}
+
+/* -- Dictionary manipulation -- */
+
+/*
+ * Format of dict.dz file.
+ *
+ * Gzip header:
+ *
+ *       +---+---+---+---+---+---+---+---+---+---+
+ *       |ID1|ID2|CM |FLG|     MTIME     |XFL|OS | (more-->)
+ *       +---+---+---+---+---+---+---+---+---+---+
+ *
+ *    (if FLG.FEXTRA set)
+ *
+ *       +---+---+=================================+
+ *       | XLEN  |...XLEN bytes of "extra field"...| (more-->)
+ *       +---+---+=================================+
+ *
+ *    (if FLG.FNAME set)
+ *
+ *       +=========================================+
+ *       |...original file name, zero-terminated...| (more-->)
+ *       +=========================================+
+ *
+ *    (if FLG.FCOMMENT set)
+ *
+ *       +===================================+
+ *       |...file comment, zero-terminated...| (more-->)
+ *       +===================================+
+ *
+ *    (if FLG.FHCRC set)
+ *
+ *       +---+---+
+ *       | CRC16 |
+ *       +---+---+
+ *
+ * Data:
+ *
+ *       +=======================+
+ *       |...compressed blocks...| (more-->)
+ *       +=======================+
+ *
+ * Footer:
+ *
+ *         0   1   2   3   4   5   6   7
+ *       +---+---+---+---+---+---+---+---+
+ *       |     CRC32     |     ISIZE     |
+ *       +---+---+---+---+---+---+---+---+
+ *
+ * Format of extra dz field (FLG.EXTRA):
+ *
+ *      +---+---+---+---+---+---+---+---+---+---+---+---+
+ *      | XLEN  |SI1|SI2| SLEN  | SVER  | CHLEN | CHCNT | (more-->)
+ *      +---+---+---+---+---+---+---+---+---+---+---+---+
+ *      +================================================+
+ *      |...CHCNT chunk compressed sizes, 2 bytes each...|
+ *      +================================================+
+ *
+ * where
+ *
+ *      SI1 = 'R', 0x52
+ *      SI2 = 'A', 0x41
+ *      SLEN = XLEN - 4
+ *      SVER = 1
+ *
+ *      CHLEN is a size of unpacked chunk.
+ *      CHCNT is count of chunks in file
+ *
+ *      Sizes of compressed chunks follow from first to CHCNT one.
+ *
+ *      Each chunk can be decompressed individually.
+ */
+
+enum {
+    GZIP_ID1 = 0x1f,
+    GZIP_ID2 = 0x8b,
+
+    GZIP_FTEXT = 1,
+    GZIP_FHCRC = 2,
+    GZIP_FEXTRA = 4,
+    GZIP_FNAME = 8,
+    GZIP_FCOMMENT = 16,
+
+    DZIP_SI1 = 0x52,
+    DZIP_SI2 = 0x41,
+};
+
+typedef enum {
+    DZ_NOT_FOUND = -1,
+    DZ_OK,
+    DZ_ERROR,
+} dz_parse_result;
+
+static dz_parse_result
+_parse_dz_header(pd_dictionary *dict, const unsigned char *file, size_t size)
+{
+    if (size < 12)
+        return DZ_NOT_FOUND;
+
+    int compression = file[2];
+    int flags = file[3];
+    unsigned xlen = le16toh(*(unsigned short *)(file + 10));
+
+    /* Basic info */
+
+    if (file[0] != GZIP_ID1 || file[1] != GZIP_ID2 || compression != 8)
+        return DZ_NOT_FOUND;
+
+    /* 'extra' field */
+
+    if (!(flags & GZIP_FEXTRA))
+        return DZ_ERROR;
+
+    if (size < 12 + xlen)
         return DZ_ERROR;
 
-    unsigned sver = le16toh(*(unsigned short *)(file + 16));
-    if (sver != 1)
-        return DZ_ERROR;
+    if (file[12] != DZIP_SI1 || file[13] != DZIP_SI2)
+        return DZ_ERROR;
+
+    unsigned slen = le16toh(*(unsigned short *)(file + 14));
+    if (slen != xlen - 4)
+        return DZ_ERROR;
+
+    unsigned sver = le16toh(*(unsigned short *)(file + 16));
+    if (sver != 1)
+        return DZ_ERROR;
+
+    dict->chunk_length = le16toh(*(unsigned short *)(file + 18));
+    dict->chunk_count = le16toh(*(unsigned short *)(file + 20));
+
+    /* skipping various header stuff */
+
+    int data_offset = 12 + xlen; /* header + extra header */
+    if (flags & GZIP_FNAME) {
+        while (data_offset < size && file[data_offset] != '\0') data_offset++;
+        data_offset++;
+        if (data_offset >= size)
+            return DZ_ERROR;
+    }
+    if (flags & GZIP_FCOMMENT) {
+        while (data_offset < size && file[data_offset] != '\0') data_offset++;
+        data_offset++;
+        if (data_offset >= size)
+            return DZ_ERROR;
+    }
+    if (flags & GZIP_FHCRC)
+        data_offset += 2;
+
+    if (data_offset >= size)
+        return DZ_ERROR;
+
+    /* chunks extra data */
+
+    dict->chunk_offsets = malloc((dict->chunk_count+1) * sizeof(size_t));
+    for (int i = 0; i < dict->chunk_count; ++i) {
+        unsigned chunk_len = le16toh(*(unsigned short *)(file + 22 + 2*i));
+        dict->chunk_offsets[i] = data_offset;
+        data_offset += chunk_len;
+    }
+    dict->chunk_offsets[dict->chunk_count] = data_offset;
+
+    if (data_offset >= size + 1) { /* data_offset might be == size */
+        free(dict->chunk_offsets);
+        return DZ_ERROR;
+    }
+
+    return DZ_OK;
+}
+
+/*
+ * Returns NULL and sets errno on error. If st is not NULL, it receives status
+ * of mapped file.
+ */
+static void *
+_mmap_ro(const char *filename, size_t *size, struct stat *st)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1)
+        return NULL;
+
+    struct stat tmp;
+    if (!st)
+        st = &tmp;
+    if (fstat(fd, st) == -1)
+        goto err;
+
+    void *ptr = mmap(NULL, st->st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED)
+        goto err;
+
+    close(fd);
+    *size = st->st_size;
+    return ptr;
+
+err:
+    close(fd);
+    return NULL;
+}
+
+/* -- Sidecar files -- */
+
+/*
+ * Sidecar files contain data derived from index file (e.g. line offset
+ * table). They are stored next to index file, in native byte order, and start
+ * with the following header:
+ *
+ *      +---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+
+ *      |             MAGIC             |    VERSION    |   SORT MODE   |
+ *      +---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+
+ *      |          INDEX SIZE           |          INDEX MTIME          |
+ *      +---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+
+ *      |             COUNT             |
+ *      +---+---+---+---+---+---+---+---+
+ *
+ * Size and modification time of index file are used to detect stale sidecars,
+ * VERSION doubles as byte order mark. Meaning of COUNT and of the data
+ * following header depends on the kind of sidecar.
+ */
+
+#define SIDECAR_VERSION 1
+#define LINE_TABLE_MAGIC "PDLINES\0"
+#define LINE_TABLE_SUFFIX ".lines"
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t sort_mode;
+    uint64_t index_size;
+    uint64_t index_mtime;
+    uint64_t count;
+} _pd_sidecar_header;
+
+static char *
+_pd_sidecar_path(const char *index_file, const char *suffix)
+{
+    char *path = malloc(strlen(index_file) + strlen(suffix) + 1);
+    if (path) {
+        strcpy(path, index_file);
+        strcat(path, suffix);
+    }
+    return path;
+}
+
+static void
+_pd_sidecar_header_init(_pd_sidecar_header *hdr, const char *magic,
+                        const struct stat *index_st)
+{
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy(hdr->magic, magic, sizeof(hdr->magic));
+    hdr->version = SIDECAR_VERSION;
+    hdr->index_size = index_st->st_size;
+    hdr->index_mtime = index_st->st_mtime;
+}
+
+/*
+ * Writes sidecar to temporary file and atomically renames it to the final
+ * name, so readers never see partially written sidecar.
+ */
+static bool
+_pd_sidecar_save(const char *path, const _pd_sidecar_header *hdr,
+                 const void *data, size_t size)
+{
+    char *tmp = _pd_sidecar_path(path, ".tmp");
+    if (!tmp)
+        return false;
+
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+        goto err;
+
+    if (write(fd, hdr, sizeof(*hdr)) != sizeof(*hdr))
+        goto err2;
+
+    for (const char *p = data; size;) {
+        ssize_t written = write(fd, p, size);
+        if (written <= 0)
+            goto err2;
+        p += written;
+        size -= written;
+    }
+
+    if (close(fd) == -1 || rename(tmp, path) == -1) {
+        unlink(tmp);
+        goto err;
+    }
+
+    free(tmp);
+    return true;
+
+err2:
+    close(fd);
+    unlink(tmp);
+err:
+    free(tmp);
+    return false;
+}
+
+/*
+ * Maps sidecar and checks that it matches index file. Returns NULL if there is
+ * no sidecar or if it is stale.
+ */
+static const _pd_sidecar_header *
+_pd_sidecar_map(const char *path, const char *magic,
+                const struct stat *index_st, size_t *size)
+{
+    const _pd_sidecar_header *hdr = _mmap_ro(path, size, NULL);
+    if (!hdr)
+        return NULL;
+
+    if (*size < sizeof(*hdr)
+        || memcmp(hdr->magic, magic, sizeof(hdr->magic))
+        || hdr->version != SIDECAR_VERSION
+        || hdr->index_size != (uint64_t)index_st->st_size
+        || hdr->index_mtime != (uint64_t)index_st->st_mtime) {
+        munmap((void *)hdr, *size);
+        return NULL;
+    }
+
+    return hdr;
+}
+
+/*
+ * Line offset table contains offsets of starts of all index lines, COUNT
+ * 32-bit offsets in total.
+ *
+ * Offsets are computed from index by pd_build_line_table(), and header ties
+ * table to that very index, so loading checks just the ends of table: reading
+ * every line would page in the whole index the table is meant to keep cold.
+ */
+static void
+_pd_load_line_table(pd_dictionary *dict, const char *index_file,
+                    const struct stat *index_st)
+{
+    char *path = _pd_sidecar_path(index_file, LINE_TABLE_SUFFIX);
+    if (!path)
+        return;
+
+    size_t size;
+    const _pd_sidecar_header *hdr =
+        _pd_sidecar_map(path, LINE_TABLE_MAGIC, index_st, &size);
+    free(path);
+    if (!hdr)
+        return;
+
+    const uint32_t *lines = (const uint32_t *)(hdr + 1);
+    size_t count = hdr->count;
+
+    if (count == 0 || size != sizeof(*hdr) + count * sizeof(uint32_t))
+        goto err;
+
+    /* The first and the last offsets should point to the ends of index */
+    const char *index = dict->index;
+    size_t last = lines[count - 1];
+    if (lines[0] != 0 || dict->index_size == 0
+        || index[dict->index_size - 1] != '\n' || last >= dict->index_size
+        || (count > 1 && (last <= lines[count - 2] || index[last - 1] != '\n'))
+        || memchr(index + last, '\n', dict->index_size - last)
+           != index + dict->index_size - 1)
+        goto err;
+
+    dict->lines_file = (void *)hdr;
+    dict->lines_file_size = size;
+    dict->lines = lines;
+    dict->line_count = count;
+    return;
+
+err:
+    munmap((void *)hdr, size);
+}
+
+pd_dict_stat
+pd_build_line_table(const char *index_file, const char *table_file)
+{
+    struct stat index_st;
+    size_t index_size;
+    const char *index = _mmap_ro(index_file, &index_size, &index_st);
+    if (!index)
+        return PICODICT_INVALID;
+
+    pd_dict_stat ret = PICODICT_INVALID;
+    char *path = NULL;
+    size_t count;
+    uint32_t *lines = _pd_line_offsets(index, index_size, &count);
+    if (!lines)
+        goto out;
+
+    path = table_file ? strdup(table_file)
+                      : _pd_sidecar_path(index_file, LINE_TABLE_SUFFIX);
+    if (!path)
+        goto out;
+
+    _pd_sidecar_header hdr;
+    _pd_sidecar_header_init(&hdr, LINE_TABLE_MAGIC, &index_st);
+    hdr.count = count;
+
+    if (_pd_sidecar_save(path, &hdr, lines, count * sizeof(uint32_t)))
+        ret = PICODICT_OK;
+
+out:
+    free(path);
+    free(lines);
+    munmap((void *)index, index_size);
+    return ret;
+}
+
+/* -- Headword trie -- */
+
+/*
+ * Trie of normalized headwords (see _pd_normalize()). Index is sorted, so
+ * lines with headwords starting with any given prefix form contiguous range
+ * of index, and every node of trie stores range of its prefix. Lookup walks
+ * the trie by bytes of query, so it costs O(length of query) for queries
+ * shorter than depth of trie.
+ *
+ * Nodes with few lines are not split further, and lines in them are
+ * binary-searched as usual, so trie takes just a fraction of index size.
+ *
+ * Nodes are stored in breadth-first order, all children of node are stored
+ * next to each other, sorted by label. Root node is the first one, COUNT in
+ * header is the number of nodes. Sort mode of trie is stored in header, as
+ * normalization depends on it.
+ */
+
+#define TRIE_MAGIC "PDTRIE\0\0"
+#define TRIE_SUFFIX ".trie"
+
+/* Nodes with this many lines or less are leaves */
+#define TRIE_BUCKET_SIZE 64
+/* Nodes with prefixes this long are leaves */
+#define TRIE_MAX_DEPTH 32
+
+typedef struct _pd_trie_node {
+    /* Index offsets: lines in [lower, upper) start with prefix of node */
+    uint32_t lower;
+    uint32_t upper;
+    /* Lines in [lower, exact_upper) are equal to prefix */
+    uint32_t exact_upper;
+    /* Number of the first child */
+    uint32_t children;
+    uint16_t child_count;
+    /* Last byte of prefix */
+    uint8_t label;
+    uint8_t reserved;
+} _pd_trie_node;
+
+static void
+_pd_load_trie(pd_dictionary *dict, const char *index_file,
+              const struct stat *index_st)
+{
+    char *path = _pd_sidecar_path(index_file, TRIE_SUFFIX);
+    if (!path)
+        return;
+
+    size_t size;
+    const _pd_sidecar_header *hdr =
+        _pd_sidecar_map(path, TRIE_MAGIC, index_st, &size);
+    free(path);
+    if (!hdr)
+        return;
+
+    const _pd_trie_node *nodes = (const _pd_trie_node *)(hdr + 1);
+    size_t count = hdr->count;
+
+    if (hdr->sort_mode != (uint32_t)dict->mode || count == 0
+        || size != sizeof(*hdr) + count * sizeof(_pd_trie_node))
+        goto err;
+
+    /* Ranges should be line-aligned, children should follow parents */
+    const char *index = dict->index;
+    for (size_t i = 0; i < count; ++i) {
+        const _pd_trie_node *n = &nodes[i];
+        if (n->lower > n->exact_upper || n->exact_upper > n->upper
+            || n->upper > dict->index_size
+            || (n->lower > 0 && index[n->lower - 1] != '\n')
+            || (n->upper > 0 && index[n->upper - 1] != '\n'))
+            goto err;
+        if (n->child_count && (n->children <= i
+                               || n->children + n->child_count > count))
+            goto err;
+    }
+
+    dict->trie_file = (void *)hdr;
+    dict->trie_file_size = size;
+    dict->trie = nodes;
+    dict->trie_count = count;
+    return;
+
+err:
+    munmap((void *)hdr, size);
+}
+
+/*
+ * Looks text up in trie. Leaves are searched using search_range function of
+ * searcher.
+ */
+static _pd_interval
+_pd_trie_search(pd_dictionary *d, const _pd_searcher *searcher,
+                const char *text, pd_find_mode options)
+{
+    const char *index = d->index;
+    const _pd_trie_node *node = d->trie;
+    _pd_interval res = { .lower = index, .upper = index };
+
+    unsigned char buf[256];
+    size_t len;
+    unsigned char *query = _pd_normalize_query(d, text, options,
+                                               buf, sizeof(buf), &len);
+    if (!query)
+        return res;
+
+    for (size_t i = 0; i < len; ++i) {
+        _pd_search_counters.probes++;
+
+        if (node->child_count == 0) {
+            res = searcher->search_range(text, index + node->lower,
+                                         index + node->upper);
+            goto out;
+        }
+
+        const _pd_trie_node *children = d->trie + node->children;
+        size_t lo = 0;
+        size_t hi = node->child_count;
+        while (lo < hi) {
+            size_t middle = lo + (hi - lo)/2;
+            if (children[middle].label < query[i])
+                lo = middle + 1;
+            else
+                hi = middle;
+        }
+
+        if (lo == node->child_count || children[lo].label != query[i]) {
+            const char *pos = index + (lo < node->child_count
+                                       ? children[lo].lower : node->upper);
+            res.lower = res.upper = pos;
+            goto out;
+        }
+        node = &children[lo];
+    }
+
+    res.lower = index + node->lower;
+    res.upper = index + (options == PICODICT_FIND_EXACT ? node->exact_upper
+                                                        : node->upper);
+
+out:
+    if (query != buf)
+        free(query);
+    _pd_search_counters_flush(d);
+    return res;
+}
+
+/* Lines covered by trie node during construction */
+typedef struct {
+    size_t first;
+    size_t last;
+    unsigned depth;
+} _pd_trie_span;
+
+pd_dict_stat
+pd_build_trie(const char *index_file, pd_sort_mode sort_mode,
+              const char *trie_file)
+{
+    if (sort_mode < 0 || sort_mode >= SORT_COUNT)
+        return PICODICT_INVALID;
+
+    struct stat index_st;
+    size_t index_size;
+    const char *index = _mmap_ro(index_file, &index_size, &index_st);
+    if (!index)
+        return PICODICT_INVALID;
+
+    pd_dict_stat ret = PICODICT_INVALID;
+    char *path = NULL;
+    unsigned char *keys = NULL;
+    uint32_t *key_offsets = NULL;
+    _pd_trie_node *nodes = NULL;
+    _pd_trie_span *spans = NULL;
+
+    size_t line_count;
+    uint32_t *lines = _pd_line_offsets(index, index_size, &line_count);
+    if (!lines)
+        goto out;
+
+    key_offsets = _pd_normalize_index(sort_mode, index, index_size,
+                                      lines, line_count, &keys);
+    if (!key_offsets)
+        goto out;
+
+#define KEY(i) (keys + key_offsets[i])
+#define KEY_LEN(i) (key_offsets[(i) + 1] - key_offsets[i])
+
+    /* Index should be sorted, or prefixes won't form contiguous ranges */
+    if (!_pd_keys_sorted(keys, key_offsets, line_count))
+        goto out;
+
+    size_t allocated = 1024;
+    size_t count = 1;
+    nodes = malloc(allocated * sizeof(_pd_trie_node));
+    spans = malloc(allocated * sizeof(_pd_trie_span));
+    if (!nodes || !spans)
+        goto out;
+
+    memset(&nodes[0], 0, sizeof(_pd_trie_node));
+    spans[0].first = 0;
+    spans[0].last = line_count;
+    spans[0].depth = 0;
+
+    for (size_t k = 0; k < count; ++k) {
+        _pd_trie_span span = spans[k];
+
+        /* Lines equal to prefix sort first */
+        size_t exact = span.first;
+        while (exact < span.last && KEY_LEN(exact) == span.depth)
+            exact++;
+
+        _pd_trie_node *node = &nodes[k];
+        node->lower = lines[span.first];
+        node->upper = span.last < line_count ? lines[span.last] : index_size;
+        node->exact_upper = exact < line_count ? lines[exact] : index_size;
+        node->children = count;
+        node->child_count = 0;
+
+        if (span.last - span.first <= TRIE_BUCKET_SIZE
+            || span.depth == TRIE_MAX_DEPTH)
+            continue;
+
+        for (size_t i = exact; i < span.last;) {
+            unsigned char label = KEY(i)[span.depth];
+            size_t j = i;
+            while (j < span.last && KEY(j)[span.depth] == label)
+                j++;
+
+            if (count == allocated) {
+                allocated *= 2;
+                _pd_trie_node *n = realloc(nodes,
+                                           allocated * sizeof(_pd_trie_node));
+                if (n)
+                    nodes = n;
+                _pd_trie_span *sp = realloc(spans,
+                                            allocated * sizeof(_pd_trie_span));
+                if (sp)
+                    spans = sp;
+                if (!n || !sp)
+                    goto out;
+                node = &nodes[k];
+            }
+
+            memset(&nodes[count], 0, sizeof(_pd_trie_node));
+            nodes[count].label = label;
+            spans[count].first = i;
+            spans[count].last = j;
+            spans[count].depth = span.depth + 1;
+            count++;
+            node->child_count++;
+
+            i = j;
+        }
+    }
+
+#undef KEY
+#undef KEY_LEN
+
+    path = trie_file ? strdup(trie_file)
+                     : _pd_sidecar_path(index_file, TRIE_SUFFIX);
+    if (!path)
+        goto out;
+
+    _pd_sidecar_header hdr;
+    _pd_sidecar_header_init(&hdr, TRIE_MAGIC, &index_st);
+    hdr.sort_mode = sort_mode;
+    hdr.count = count;
+
+    if (_pd_sidecar_save(path, &hdr, nodes, count * sizeof(_pd_trie_node)))
+        ret = PICODICT_OK;
+
+out:
+    free(path);
+    free(spans);
+    free(nodes);
+    free(key_offsets);
+    free(keys);
+    free(lines);
+    munmap((void *)index, index_size);
+    return ret;
+}
+
+/* -- Bloom filter -- */
+
+/*
+ * Bloom filter of normalized headwords (see _pd_normalize()) lets exact
+ * lookups of missing words return without searching index.
+ *
+ * Filter is split into 64-byte blocks, and all bits of a headword are set in
+ * the same block, so check costs a single cache miss. COUNT in header is the
+ * number of blocks. Sort mode of filter is stored in header, as
+ * normalization depends on it.
+ */
+
+#define BLOOM_MAGIC "PDBLOOM\0"
+#define BLOOM_SUFFIX ".bloom"
+
+#define BLOOM_BLOCK_WORDS 8
+#define BLOOM_BITS_PER_KEY 12
+/* Each bit number takes 9 bits of hash, 63 bits are available */
+#define BLOOM_HASHES 7
+
+static uint64_t
+_pd_mix(uint64_t h)
+{
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+/*
+ * FNV-1a, with bits spread by finalizer of splitmix64.
+ */
+static uint64_t
+_pd_hash(const unsigned char *str, size_t len, uint64_t seed)
+{
+    uint64_t h = 0xcbf29ce484222325ULL ^ seed;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= str[i];
+        h *= 0x100000001b3ULL;
+    }
+    return _pd_mix(h);
+}
+
+static uint64_t *
+_pd_bloom_block(const uint64_t *bloom, size_t blocks, uint64_t hash)
+{
+    size_t block = ((hash >> 32) * blocks) >> 32;
+    return (uint64_t *)bloom + block * BLOOM_BLOCK_WORDS;
+}
+
+static void
+_pd_load_bloom(pd_dictionary *dict, const char *index_file,
+               const struct stat *index_st)
+{
+    char *path = _pd_sidecar_path(index_file, BLOOM_SUFFIX);
+    if (!path)
+        return;
+
+    size_t size;
+    const _pd_sidecar_header *hdr =
+        _pd_sidecar_map(path, BLOOM_MAGIC, index_st, &size);
+    free(path);
+    if (!hdr)
+        return;
+
+    size_t count = hdr->count;
+    if (hdr->sort_mode != (uint32_t)dict->mode || count == 0
+        || count > UINT32_MAX
+        || size != sizeof(*hdr) + count * BLOOM_BLOCK_WORDS * sizeof(uint64_t)) {
+        munmap((void *)hdr, size);
+        return;
+    }
+
+    dict->bloom_file = (void *)hdr;
+    dict->bloom_file_size = size;
+    dict->bloom = (const uint64_t *)(hdr + 1);
+    dict->bloom_blocks = count;
+}
+
+/*
+ * Returns false if there is certainly no headword equal to text.
+ */
+static bool
+_pd_bloom_check(pd_dictionary *d, const char *text)
+{
+    unsigned char buf[256];
+    size_t len;
+    unsigned char *query = _pd_normalize_query(d, text, PICODICT_FIND_EXACT,
+                                               buf, sizeof(buf), &len);
+    if (!query)
+        return true;
+
+    uint64_t hash = _pd_hash(query, len, 0);
+    const uint64_t *block = _pd_bloom_block(d->bloom, d->bloom_blocks, hash);
+    uint64_t bits = _pd_mix(hash);
+
+    bool found = true;
+    for (int i = 0; i < BLOOM_HASHES && found; ++i, bits >>= 9)
+        found = block[(bits & 511) >> 6] & (1ULL << (bits & 63));
+
+    if (query != buf)
+        free(query);
+    return found;
+}
+
+pd_dict_stat
+pd_build_bloom(const char *index_file, pd_sort_mode sort_mode,
+               const char *bloom_file)
+{
+    if (sort_mode < 0 || sort_mode >= SORT_COUNT)
+        return PICODICT_INVALID;
+
+    struct stat index_st;
+    size_t index_size;
+    const char *index = _mmap_ro(index_file, &index_size, &index_st);
+    if (!index)
+        return PICODICT_INVALID;
+
+    pd_dict_stat ret = PICODICT_INVALID;
+    char *path = NULL;
+    unsigned char *keys = NULL;
+    uint32_t *key_offsets = NULL;
+    uint64_t *bloom = NULL;
+
+    size_t line_count;
+    uint32_t *lines = _pd_line_offsets(index, index_size, &line_count);
+    if (!lines)
+        goto out;
+
+    key_offsets = _pd_normalize_index(sort_mode, index, index_size,
+                                      lines, line_count, &keys);
+    if (!key_offsets)
+        goto out;
+
+    size_t block_bits = BLOOM_BLOCK_WORDS * 64;
+    size_t blocks = (line_count * BLOOM_BITS_PER_KEY + block_bits - 1)
+                  / block_bits;
+    bloom = calloc(blocks, BLOOM_BLOCK_WORDS * sizeof(uint64_t));
+    if (!bloom)
+        goto out;
+
+    for (size_t i = 0; i < line_count; ++i) {
+        uint64_t hash = _pd_hash(keys + key_offsets[i],
+                                 key_offsets[i + 1] - key_offsets[i], 0);
+        uint64_t *block = _pd_bloom_block(bloom, blocks, hash);
+        uint64_t bits = _pd_mix(hash);
+        for (int j = 0; j < BLOOM_HASHES; ++j, bits >>= 9)
+            block[(bits & 511) >> 6] |= 1ULL << (bits & 63);
+    }
+
+    path = bloom_file ? strdup(bloom_file)
+                      : _pd_sidecar_path(index_file, BLOOM_SUFFIX);
+    if (!path)
+        goto out;
+
+    _pd_sidecar_header hdr;
+    _pd_sidecar_header_init(&hdr, BLOOM_MAGIC, &index_st);
+    hdr.sort_mode = sort_mode;
+    hdr.count = blocks;
+
+    if (_pd_sidecar_save(path, &hdr, bloom,
+                         blocks * BLOOM_BLOCK_WORDS * sizeof(uint64_t)))
+        ret = PICODICT_OK;
+
+out:
+    free(path);
+    free(bloom);
+    free(key_offsets);
+    free(keys);
+    free(lines);
+    munmap((void *)index, index_size);
+    return ret;
+}
+
+/* -- Perfect hash -- */
+
+/*
+ * Minimal perfect hash of distinct normalized headwords (see
+ * _pd_normalize()), built with hash-and-displace method. Keys are split into
+ * buckets by hash, and every bucket has a pilot value chosen so that
+ *
+ *      slot = mix(hash ^ mix(pilot + 1)) % COUNT
+ *
+ * is different for all COUNT keys. Every slot stores range of index lines
+ * with its key, so exact lookup is a hash, a pilot read and a single
+ * comparison verifying that headword at slot is the query.
+ *
+ * Data following header consists of 32-bit pilots of all buckets followed by
+ * COUNT slots. Sort mode of hash is stored in header, as normalization
+ * depends on it.
+ */
+
+#define PHASH_MAGIC "PDPHASH\0"
+#define PHASH_SUFFIX ".phash"
+
+/* Average number of keys in bucket */
+#define PHASH_BUCKET_SIZE 4
+/* Pilots are searched up to this value before giving up */
+#define PHASH_MAX_PILOT (1U << 24)
+
+typedef struct _pd_phash_slot {
+    /* Index offsets: lines in [lower, upper) have key of slot */
+    uint32_t lower;
+    uint32_t upper;
+} _pd_phash_slot;
+
+static size_t
+_pd_phash_buckets(size_t count)
+{
+    return (count + PHASH_BUCKET_SIZE - 1) / PHASH_BUCKET_SIZE;
+}
+
+static size_t
+_pd_phash_bucket(uint64_t hash, size_t buckets)
+{
+    return ((hash >> 32) * buckets) >> 32;
+}
+
+static size_t
+_pd_phash_slot_of(uint64_t hash, uint32_t pilot, size_t count)
+{
+    return _pd_mix(hash ^ _pd_mix((uint64_t)pilot + 1)) % count;
+}
+
+static void
+_pd_load_phash(pd_dictionary *dict, const char *index_file,
+               const struct stat *index_st)
+{
+    char *path = _pd_sidecar_path(index_file, PHASH_SUFFIX);
+    if (!path)
+        return;
+
+    size_t size;
+    const _pd_sidecar_header *hdr =
+        _pd_sidecar_map(path, PHASH_MAGIC, index_st, &size);
+    free(path);
+    if (!hdr)
+        return;
+
+    size_t count = hdr->count;
+    size_t buckets = _pd_phash_buckets(count);
+    const uint32_t *pilots = (const uint32_t *)(hdr + 1);
+    const _pd_phash_slot *slots = (const _pd_phash_slot *)(pilots + buckets);
+
+    if (hdr->sort_mode != (uint32_t)dict->mode || count == 0
+        || count > UINT32_MAX
+        || size != sizeof(*hdr) + buckets * sizeof(uint32_t)
+                   + count * sizeof(_pd_phash_slot))
+        goto err;
+
+    /* Ranges should be line-aligned and non-empty */
+    const char *index = dict->index;
+    for (size_t i = 0; i < count; ++i)
+        if (slots[i].lower >= slots[i].upper
+            || slots[i].upper > dict->index_size
+            || (slots[i].lower > 0 && index[slots[i].lower - 1] != '\n')
+            || index[slots[i].upper - 1] != '\n')
+            goto err;
+
+    dict->phash_file = (void *)hdr;
+    dict->phash_file_size = size;
+    dict->phash_pilots = pilots;
+    dict->phash_slots = slots;
+    dict->phash_count = count;
+    return;
+
+err:
+    munmap((void *)hdr, size);
+}
+
+/*
+ * Looks text up in perfect hash. searcher is used to verify that headword
+ * found is the one looked for.
+ */
+static _pd_interval
+_pd_phash_search(pd_dictionary *d, const _pd_searcher *searcher,
+                 const char *text)
+{
+    const char *index = d->index;
+    _pd_interval res = { .lower = index, .upper = index };
+
+    unsigned char buf[256];
+    size_t len;
+    unsigned char *query = _pd_normalize_query(d, text, PICODICT_FIND_EXACT,
+                                               buf, sizeof(buf), &len);
+    if (!query)
+        return res;
+
+    uint64_t hash = _pd_hash(query, len, 0);
+    size_t count = d->phash_count;
+    uint32_t pilot =
+        d->phash_pilots[_pd_phash_bucket(hash, _pd_phash_buckets(count))];
+    const _pd_phash_slot *slot =
+        &d->phash_slots[_pd_phash_slot_of(hash, pilot, count)];
+
+    _pd_search_counters.probes++;
+    _pd_search_counters.comparisons++;
+    if (searcher->cmp(text, index + slot->lower) == 0) {
+        res.lower = index + slot->lower;
+        res.upper = index + slot->upper;
+    }
+
+    if (query != buf)
+        free(query);
+    _pd_search_counters_flush(d);
+    return res;
+}
+
+typedef struct {
+    uint64_t hash;
+    size_t bucket;
+    _pd_phash_slot lines;
+} _pd_phash_key;
+
+static int
+_pd_phash_key_cmp(const void *lhs, const void *rhs)
+{
+    const _pd_phash_key *l = lhs;
+    const _pd_phash_key *r = rhs;
+    return l->bucket < r->bucket ? -1 : l->bucket > r->bucket;
+}
+
+typedef struct {
+    /* Keys of bucket are keys[first .. first + size) */
+    size_t first;
+    size_t size;
+    size_t id;
+} _pd_phash_bucket_span;
+
+static int
+_pd_phash_bucket_cmp(const void *lhs, const void *rhs)
+{
+    const _pd_phash_bucket_span *l = lhs;
+    const _pd_phash_bucket_span *r = rhs;
+    /* The biggest buckets are the hardest to place, they go first */
+    if (l->size != r->size)
+        return l->size > r->size ? -1 : 1;
+    return l->id < r->id ? -1 : l->id > r->id;
+}
+
+pd_dict_stat
+pd_build_perfect_hash(const char *index_file, pd_sort_mode sort_mode,
+                      const char *hash_file)
+{
+    if (sort_mode < 0 || sort_mode >= SORT_COUNT)
+        return PICODICT_INVALID;
+
+    struct stat index_st;
+    size_t index_size;
+    const char *index = _mmap_ro(index_file, &index_size, &index_st);
+    if (!index)
+        return PICODICT_INVALID;
+
+    pd_dict_stat ret = PICODICT_INVALID;
+    char *path = NULL;
+    unsigned char *keys = NULL;
+    uint32_t *key_offsets = NULL;
+    _pd_phash_key *hkeys = NULL;
+    _pd_phash_bucket_span *spans = NULL;
+    unsigned char *data = NULL;
+    bool *taken = NULL;
+    size_t *bucket_slots = NULL;
+
+    size_t line_count;
+    uint32_t *lines = _pd_line_offsets(index, index_size, &line_count);
+    if (!lines)
+        goto out;
+
+    key_offsets = _pd_normalize_index(sort_mode, index, index_size,
+                                      lines, line_count, &keys);
+    if (!key_offsets)
+        goto out;
+
+    /* Lines with equal keys should be adjacent */
+    if (!_pd_keys_sorted(keys, key_offsets, line_count))
+        goto out;
+
+    hkeys = malloc(line_count * sizeof(_pd_phash_key));
+    if (!hkeys)
+        goto out;
+
+    /* Distinct keys */
+    size_t count = 0;
+    for (size_t i = 0; i < line_count;) {
+        size_t len = key_offsets[i + 1] - key_offsets[i];
+        size_t j = i + 1;
+        while (j < line_count && key_offsets[j + 1] - key_offsets[j] == len
+               && !memcmp(keys + key_offsets[i], keys + key_offsets[j], len))
+            j++;
+
+        hkeys[count].hash = _pd_hash(keys + key_offsets[i], len, 0);
+        hkeys[count].lines.lower = lines[i];
+        hkeys[count].lines.upper = j < line_count ? lines[j] : index_size;
+        count++;
+        i = j;
+    }
+
+    size_t buckets = _pd_phash_buckets(count);
+    for (size_t i = 0; i < count; ++i)
+        hkeys[i].bucket = _pd_phash_bucket(hkeys[i].hash, buckets);
+    qsort(hkeys, count, sizeof(_pd_phash_key), _pd_phash_key_cmp);
+
+    spans = calloc(buckets, sizeof(_pd_phash_bucket_span));
+    if (!spans)
+        goto out;
+    for (size_t b = 0; b < buckets; ++b)
+        spans[b].id = b;
+    for (size_t i = count; i > 0; --i) {
+        spans[hkeys[i - 1].bucket].first = i - 1;
+        spans[hkeys[i - 1].bucket].size++;
+    }
+    qsort(spans, buckets, sizeof(_pd_phash_bucket_span), _pd_phash_bucket_cmp);
+
+    size_t data_size = buckets * sizeof(uint32_t)
+                     + count * sizeof(_pd_phash_slot);
+    data = calloc(1, data_size);
+    taken = calloc(count, sizeof(bool));
+    bucket_slots = malloc(spans[0].size * sizeof(size_t));
+    if (!data || !taken || !bucket_slots)
+        goto out;
+
+    uint32_t *pilots = (uint32_t *)data;
+    _pd_phash_slot *slots = (_pd_phash_slot *)(pilots + buckets);
+
+    for (size_t b = 0; b < buckets && spans[b].size; ++b) {
+        const _pd_phash_key *bkeys = hkeys + spans[b].first;
+        size_t size = spans[b].size;
+
+        uint32_t pilot = 0;
+        for (;; ++pilot) {
+            if (pilot == PHASH_MAX_PILOT)
+                goto out;
+
+            size_t placed = 0;
+            for (; placed < size; ++placed) {
+                size_t slot = _pd_phash_slot_of(bkeys[placed].hash, pilot,
+                                                count);
+                if (taken[slot])
+                    break;
+                /* Keys of bucket should not collide with each other either */
+                taken[slot] = true;
+                bucket_slots[placed] = slot;
+            }
+            if (placed == size)
+                break;
+            for (size_t i = 0; i < placed; ++i)
+                taken[bucket_slots[i]] = false;
+        }
+
+        pilots[spans[b].id] = pilot;
+        for (size_t i = 0; i < size; ++i)
+            slots[bucket_slots[i]] = bkeys[i].lines;
+    }
+
+    path = hash_file ? strdup(hash_file)
+                     : _pd_sidecar_path(index_file, PHASH_SUFFIX);
+    if (!path)
+        goto out;
+
+    _pd_sidecar_header hdr;
+    _pd_sidecar_header_init(&hdr, PHASH_MAGIC, &index_st);
+    hdr.sort_mode = sort_mode;
+    hdr.count = count;
+
+    if (_pd_sidecar_save(path, &hdr, data, data_size))
+        ret = PICODICT_OK;
+
+out:
+    free(path);
+    free(bucket_slots);
+    free(taken);
+    free(data);
+    free(spans);
+    free(hkeys);
+    free(key_offsets);
+    free(keys);
+    free(lines);
+    munmap((void *)index, index_size);
+    return ret;
+}
+
+/* -- Decompression -- */
+
+/*
+ * Decompression engine. Chunks are always decompressed as a whole, so engine
+ * gets the whole compressed chunk and a buffer for the whole decompressed one.
+ *
+ * zlib is used by default, libdeflate may be selected at configure time
+ * (--with-libdeflate), it is significantly faster at decompressing whole
+ * buffers.
+ */
+typedef struct {
+    void *(*alloc)(void);
+    void (*free)(void *state);
+    /*
+     * Decompresses in_size bytes of in to out, which is *out_size bytes long,
+     * storing amount of decompressed data to out_size. Returns false on
+     * malformed data.
+     */
+    bool (*inflate)(void *state, const unsigned char *in, size_t in_size,
+                    char *out, size_t *out_size);
+} _pd_inflate_engine;
+
+#ifdef HAVE_LIBDEFLATE
+
+typedef struct {
+    struct libdeflate_decompressor *d;
+    unsigned char *in;
+    size_t in_allocated;
+} _pd_libdeflate;
+
+static void *
+_pd_libdeflate_alloc(void)
+{
+    _pd_libdeflate *state = calloc(1, sizeof(_pd_libdeflate));
+    if (!state)
+        return NULL;
+
+    state->d = libdeflate_alloc_decompressor();
+    if (!state->d) {
+        free(state);
+        return NULL;
+    }
+    return state;
+}
+
+static void
+_pd_libdeflate_free(void *state)
+{
+    _pd_libdeflate *st = state;
+    libdeflate_free_decompressor(st->d);
+    free(st->in);
+    free(st);
+}
+
+/*
+ * libdeflate decompresses complete deflate streams only, and every chunk but
+ * the last ends with full flush instead of final block. Full flush leaves
+ * stream byte-aligned, so chunk is terminated by appending an empty final
+ * block with fixed Huffman codes (BFINAL = 1, BTYPE = 01, end-of-block code).
+ */
+static bool
+_pd_libdeflate_inflate(void *state, const unsigned char *in, size_t in_size,
+                       char *out, size_t *out_size)
+{
+    _pd_libdeflate *st = state;
+
+    if (st->in_allocated < in_size + 2) {
+        unsigned char *buf = realloc(st->in, in_size + 2);
+        if (!buf)
+            return false;
+        st->in = buf;
+        st->in_allocated = in_size + 2;
+    }
+    memcpy(st->in, in, in_size);
+    st->in[in_size] = 0x03;
+    st->in[in_size + 1] = 0x00;
+
+    size_t actual_in;
+    enum libdeflate_result ret =
+        libdeflate_deflate_decompress_ex(st->d, st->in, in_size + 2, out,
+                                         *out_size, &actual_in, out_size);
+    return ret == LIBDEFLATE_SUCCESS;
+}
+
+static const _pd_inflate_engine _pd_engine = {
+    _pd_libdeflate_alloc,
+    _pd_libdeflate_free,
+    _pd_libdeflate_inflate,
+};
+
+#else
+
+static void *
+_pd_zlib_alloc(void)
+{
+    z_stream *z = calloc(1, sizeof(z_stream));
+    if (!z)
+        return NULL;
+
+    z->zalloc = Z_NULL;
+    z->zfree = Z_NULL;
+    z->opaque = Z_NULL;
+    if (inflateInit2(z, -15) != Z_OK) {
+        free(z);
+        return NULL;
+    }
+    return z;
+}
+
+static void
+_pd_zlib_free(void *state)
+{
+    inflateEnd(state);
+    free(state);
+}
+
+static bool
+_pd_zlib_inflate(void *state, const unsigned char *in, size_t in_size,
+                 char *out, size_t *out_size)
+{
+    z_stream *z = state;
+    inflateReset(z);
+    z->next_in = (unsigned char *)in;
+    z->avail_in = in_size;
+    z->next_out = (unsigned char *)out;
+    z->avail_out = *out_size;
+
+    int ret = inflate(z, Z_PARTIAL_FLUSH);
+    *out_size -= z->avail_out;
+    return ret == Z_OK || ret == Z_STREAM_END;
+}
+
+static const _pd_inflate_engine _pd_engine = {
+    _pd_zlib_alloc,
+    _pd_zlib_free,
+    _pd_zlib_inflate,
+};
+
+#endif
+
+static _pd_inflater *
+_pd_inflater_get(pd_dictionary *dict)
+{
+    pthread_mutex_lock(&dict->inflaters_lock);
+    _pd_inflater *inf = dict->inflaters;
+    if (inf)
+        dict->inflaters = inf->next;
+    pthread_mutex_unlock(&dict->inflaters_lock);
+
+    if (inf)
+        return inf;
+
+    inf = calloc(1, sizeof(_pd_inflater));
+    if (!inf)
+        return NULL;
+
+    inf->state = _pd_engine.alloc();
+    if (!inf->state) {
+        free(inf);
+        return NULL;
+    }
+    return inf;
+}
+
+static void
+_pd_inflater_put(pd_dictionary *dict, _pd_inflater *inf)
+{
+    pthread_mutex_lock(&dict->inflaters_lock);
+    inf->next = dict->inflaters;
+    dict->inflaters = inf;
+    pthread_mutex_unlock(&dict->inflaters_lock);
+}
+
+static void
+_pd_inflaters_free(pd_dictionary *dict)
+{
+    while (dict->inflaters) {
+        _pd_inflater *inf = dict->inflaters;
+        dict->inflaters = inf->next;
+        _pd_engine.free(inf->state);
+        free(inf);
+    }
+}
+
+/*
+ * Decompresses chunk to out, which should be chunk_length bytes long. If size
+ * is not NULL, it receives amount of decompressed data (the last chunk is
+ * usually shorter than the others).
+ *
+ * Chunks are separated by full flushes in compressed stream, so each of them
+ * is decompressed from scratch and any inflater may be used.
+ */
+static bool
+_uncompress_chunk(pd_dictionary *dict, int chunk_id, char *out, size_t *size)
+{
+    _pd_inflater *inf = _pd_inflater_get(dict);
+    if (!inf)
+        return false;
+
+    const unsigned char *in =
+        (unsigned char *)dict->data + dict->chunk_offsets[chunk_id];
+    size_t in_size =
+        dict->chunk_offsets[chunk_id + 1] - dict->chunk_offsets[chunk_id];
+    size_t out_size = dict->chunk_length;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    bool ret = _pd_engine.inflate(inf->state, in, in_size, out, &out_size);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (size)
+        *size = out_size;
+
+    _pd_inflater_put(dict, inf);
+
+    STAT_ADD(dict, bytes_inflated, out_size);
+    STAT_ADD(dict, inflate_usec, (end.tv_sec - start.tv_sec) * 1000000
+                                 + (end.tv_nsec - start.tv_nsec) / 1000);
+
+    return ret;
+}
+
+/* -- Chunk store -- */
+
+/*
+ * Chunk store keeps decompressed chunks in a file, so they survive restarts
+ * and are shared by processes using the same dictionary. Store may also live
+ * in POSIX shared memory object named after device and inode of data file
+ * (see PICODICT_OPEN_SHARED_CHUNKS), then every chunk is inflated once per
+ * machine until reboot. File is mapped by every process using it and
+ * consists of the following parts:
+ *
+ *      +--------+---------------------+-------------------------------+
+ *      | HEADER | SLOTS (slot_count)  | DATA (slot_count chunks)      |
+ *      +--------+---------------------+-------------------------------+
+ *
+ * Header identifies the data file by its size and modification time. Chunk
+ * is stored to slot (chunk id % slot_count), replacing chunk stored there
+ * before.
+ *
+ * File is mapped read-only and written by pwrite() only, so stray write can't
+ * damage chunks seen by other processes. Processes which may not write to the
+ * file (those of other users, as file is created with mode 0644) use it
+ * read-only, and just don't store chunks they inflate.
+ *
+ * Slots are guarded by sequence numbers. Writer makes sequence number odd
+ * before changing slot and even again afterwards, so reader copying chunk
+ * knows it got consistent data if sequence number was even and did not
+ * change while copying. Writers lock slot with fcntl() record lock, and give
+ * up if slot is already being written by another process. Lock of crashed
+ * writer is released by the kernel, and slot it left odd is just written
+ * again by the next writer.
+ *
+ * Every process holds shared flock() on the file while it uses it. Process
+ * getting exclusive lock on opening is the only user of the file, so it may
+ * safely (re)initialize the file.
+ */
+
+#define CHUNK_STORE_MAGIC "PDCHUNKS"
+#define CHUNK_STORE_SUFFIX ".chunks"
+#define CHUNK_STORE_VERSION 1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t chunk_length;
+    uint64_t slot_count;
+    uint64_t data_size;
+    uint64_t data_mtime;
+} _pd_chunk_store_header;
+
+typedef struct {
+    uint32_t seq;
+    /* Chunk id + 1, 0 for empty slot */
+    uint32_t key;
+    uint32_t size;
+    uint32_t reserved;
+} _pd_chunk_store_slot;
+
+typedef struct _pd_chunk_store {
+    int fd;
+    bool writable;
+    /* Record locks are per process, threads of process take this first */
+    pthread_mutex_t write_lock;
+
+    const void *map;
+    size_t map_size;
+    const _pd_chunk_store_slot *slots;
+    size_t slot_count;
+    const char *data;
+    size_t data_offset;
+    size_t chunk_length;
+} _pd_chunk_store;
+
+static char *
+_pd_chunk_store_path(const char *data_file, const char *dir)
+{
+    if (!dir)
+        return _pd_sidecar_path(data_file, CHUNK_STORE_SUFFIX);
+
+    const char *base = strrchr(data_file, '/');
+    base = base ? base + 1 : data_file;
+
+    char *path = malloc(strlen(dir) + strlen(base)
+                        + strlen(CHUNK_STORE_SUFFIX) + 2);
+    if (path)
+        sprintf(path, "%s/%s%s", dir, base, CHUNK_STORE_SUFFIX);
+    return path;
+}
+
+/*
+ * Opens store file for writing or, if that is not permitted, for reading.
+ */
+static int
+_pd_chunk_store_fd(const char *data_file, const struct stat *data_st,
+                   const pd_open_options *options, bool *writable)
+{
+    int fd;
+    *writable = true;
+
+    if (options->flags & PICODICT_OPEN_SHARED_CHUNKS) {
+        char name[64];
+        snprintf(name, sizeof(name), "/picodict-%llx-%llx",
+                 (unsigned long long)data_st->st_dev,
+                 (unsigned long long)data_st->st_ino);
+        fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd == -1 && errno == EACCES) {
+            *writable = false;
+            fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+        }
+        return fd;
+    }
+
+    char *path = _pd_chunk_store_path(data_file, options->chunk_store_dir);
+    if (!path)
+        return -1;
+    fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1 && errno == EACCES) {
+        *writable = false;
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+    }
+    free(path);
+    return fd;
+}
+
+static size_t
+_pd_chunk_store_data_offset(size_t slot_count)
+{
+    size_t offset = sizeof(_pd_chunk_store_header)
+                  + slot_count * sizeof(_pd_chunk_store_slot);
+    long page = sysconf(_SC_PAGESIZE);
+    return (offset + page - 1) / page * page;
+}
+
+/*
+ * Opens chunk store of compressed dictionary, creating it if needed. Returns
+ * NULL if store can't be used.
+ */
+static _pd_chunk_store *
+_pd_chunk_store_open(pd_dictionary *dict, const char *data_file,
+                     const struct stat *data_st, const pd_open_options *options)
+{
+    size_t size = options->chunk_store_size;
+    if (size == 0)
+        size = CHUNK_STORE_SIZE;
+
+    size_t slot_count = size / (dict->chunk_length
+                                + sizeof(_pd_chunk_store_slot));
+    if (slot_count > dict->chunk_count)
+        slot_count = dict->chunk_count;
+    if (slot_count == 0)
+        return NULL;
+
+    _pd_chunk_store_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, CHUNK_STORE_MAGIC, sizeof(hdr.magic));
+    hdr.version = CHUNK_STORE_VERSION;
+    hdr.chunk_length = dict->chunk_length;
+    hdr.slot_count = slot_count;
+    hdr.data_size = data_st->st_size;
+    hdr.data_mtime = data_st->st_mtime;
+
+    size_t data_offset = _pd_chunk_store_data_offset(slot_count);
+    size_t data_size = slot_count * dict->chunk_length;
+    size_t store_size = data_offset + data_size;
+    if (store_size < data_size || (off_t)store_size < 0
+        || (size_t)(off_t)store_size != store_size)
+        return NULL;
+
+    _pd_chunk_store *st = calloc(1, sizeof(_pd_chunk_store));
+    if (!st)
+        return NULL;
+
+    st->fd = _pd_chunk_store_fd(data_file, data_st, options, &st->writable);
+    if (st->fd == -1)
+        goto err;
+
+    bool exclusive = !flock(st->fd, LOCK_EX | LOCK_NB);
+    if (!exclusive && flock(st->fd, LOCK_SH))
+        goto err2;
+
+    struct stat store_st;
+    if (fstat(st->fd, &store_st))
+        goto err2;
+
+    _pd_chunk_store_header old;
+    bool valid = store_st.st_size == (off_t)store_size
+              && pread(st->fd, &old, sizeof(old), 0) == sizeof(old)
+              && !memcmp(&old, &hdr, sizeof(hdr));
+    if (!valid) {
+        /* File is in use by others with different parameters */
+        if (!exclusive || !st->writable)
+            goto err2;
+        if (ftruncate(st->fd, 0) || ftruncate(st->fd, store_size)
+            || pwrite(st->fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+            goto err2;
+    }
+
+    if (exclusive && flock(st->fd, LOCK_SH))
+        goto err2;
+
+    st->map = mmap(NULL, store_size, PROT_READ, MAP_SHARED, st->fd, 0);
+    if (st->map == MAP_FAILED)
+        goto err2;
+    st->map_size = store_size;
+    st->slots = (const _pd_chunk_store_slot *)
+        ((const char *)st->map + sizeof(_pd_chunk_store_header));
+    st->slot_count = slot_count;
+    st->data = (const char *)st->map + data_offset;
+    st->data_offset = data_offset;
+    st->chunk_length = dict->chunk_length;
+    pthread_mutex_init(&st->write_lock, NULL);
+
+    return st;
+
+err2:
+    close(st->fd);
+err:
+    free(st);
+    return NULL;
+}
+
+static void
+_pd_chunk_store_close(_pd_chunk_store *st)
+{
+    pthread_mutex_destroy(&st->write_lock);
+    munmap((void *)st->map, st->map_size);
+    close(st->fd);
+    free(st);
+}
+
+/*
+ * Copies chunk from store to out. Returns false if chunk is not there.
+ *
+ * Copying races with writers, but result is discarded if that happened.
+ */
+__attribute__((no_sanitize_thread))
+static bool
+_pd_chunk_store_read(_pd_chunk_store *st, int chunk_id, char *out)
+{
+    const _pd_chunk_store_slot *slot = &st->slots[chunk_id % st->slot_count];
+
+    uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1)
+        return false;
+    uint32_t key = __atomic_load_n(&slot->key, __ATOMIC_RELAXED);
+    if (key != (uint32_t)chunk_id + 1)
+        return false;
+    size_t size = __atomic_load_n(&slot->size, __ATOMIC_RELAXED);
+    if (size > st->chunk_length)
+        return false;
+
+    memcpy(out, st->data + (chunk_id % st->slot_count) * st->chunk_length,
+           size);
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq;
+}
+
+static bool
+_pd_chunk_store_pwrite(_pd_chunk_store *st, const void *buf, size_t size,
+                       off_t offset)
+{
+    return pwrite(st->fd, buf, size, offset) == (ssize_t)size;
+}
+
+static void
+_pd_chunk_store_write(_pd_chunk_store *st, int chunk_id, const char *data,
+                      size_t size)
+{
+    if (!st->writable)
+        return;
+
+    size_t slot_id = chunk_id % st->slot_count;
+    off_t slot_offset = sizeof(_pd_chunk_store_header)
+                      + slot_id * sizeof(_pd_chunk_store_slot);
+    off_t data_offset = st->data_offset + (off_t)slot_id * st->chunk_length;
+
+    pthread_mutex_lock(&st->write_lock);
+
+    struct flock lock = {
+        .l_type = F_WRLCK,
+        .l_whence = SEEK_SET,
+        .l_start = slot_offset,
+        .l_len = sizeof(_pd_chunk_store_slot),
+    };
+    if (fcntl(st->fd, F_SETLK, &lock) == -1)
+        goto out;
+
+    /* Sequence number may be left odd by crashed writer */
+    _pd_chunk_store_slot slot;
+    slot.seq = __atomic_load_n(&st->slots[slot_id].seq, __ATOMIC_RELAXED) | 1;
+    if (!_pd_chunk_store_pwrite(st, &slot.seq, sizeof(slot.seq), slot_offset))
+        goto unlock;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    bool ok = _pd_chunk_store_pwrite(st, data, size, data_offset);
+
+    slot.key = ok ? chunk_id + 1 : 0;
+    slot.size = size;
+    slot.reserved = 0;
+    if (!_pd_chunk_store_pwrite(st, (char *)&slot + sizeof(slot.seq),
+                                sizeof(slot) - sizeof(slot.seq),
+                                slot_offset + sizeof(slot.seq)))
+        goto unlock;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    /* Slot stays odd until written again if this fails */
+    slot.seq++;
+    _pd_chunk_store_pwrite(st, &slot.seq, sizeof(slot.seq), slot_offset);
+
+unlock:
+    lock.l_type = F_UNLCK;
+    fcntl(st->fd, F_SETLK, &lock);
+out:
+    pthread_mutex_unlock(&st->write_lock);
+}
+
+/* -- Chunk cache -- */
+
+/*
+ * Chunk caches may be shared between dictionaries, so every dictionary gets a
+ * unique serial number to distinguish its chunks.
+ */
+static uint64_t _pd_next_serial;
+
+static size_t
+_pd_chunk_size(pd_dictionary *dict)
+{
+    return sizeof(_pd_chunk) + dict->chunk_length;
+}
+
+pd_cache *
+pd_cache_new(size_t size, unsigned concurrency)
+{
+    size_t shards = concurrency;
+    if (shards == 0)
+        shards = 1;
+    if (shards > CHUNK_CACHE_MAX_SHARDS)
+        shards = CHUNK_CACHE_MAX_SHARDS;
+
+    pd_cache *cache =
+        calloc(1, sizeof(pd_cache) + shards * sizeof(_pd_chunk_cache));
+    if (!cache)
+        return NULL;
+
+    cache->refcount = 1;
+    cache->shard_count = shards;
+
+    for (size_t i = 0; i < shards; ++i) {
+        _pd_chunk_cache *shard = &cache->shards[i];
+        shard->buckets = calloc(4, sizeof(_pd_chunk *));
+        if (!shard->buckets) {
+            while (i--)
+                free(cache->shards[i].buckets);
+            free(cache);
+            return NULL;
+        }
+        pthread_mutex_init(&shard->lock, NULL);
+        shard->bucket_mask = 3;
+        shard->lru.lru_next = shard->lru.lru_prev = &shard->lru;
+        shard->budget = size / shards;
+    }
+    return cache;
+}
+
+static pd_cache *
+_pd_cache_ref(pd_cache *cache)
+{
+    __sync_add_and_fetch(&cache->refcount, 1);
+    return cache;
+}
+
+void
+pd_cache_free(pd_cache *cache)
+{
+    if (__sync_sub_and_fetch(&cache->refcount, 1))
+        return;
+
+    for (size_t i = 0; i < cache->shard_count; ++i) {
+        _pd_chunk_cache *shard = &cache->shards[i];
+        _pd_chunk *chunk = shard->lru.lru_next;
+        while (chunk != &shard->lru) {
+            _pd_chunk *next = chunk->lru_next;
+            free(chunk);
+            chunk = next;
+        }
+        free(shard->buckets);
+        pthread_mutex_destroy(&shard->lock);
+    }
+    free(cache);
+}
+
+static void
+_pd_lru_unlink(_pd_chunk *chunk)
+{
+    chunk->lru_prev->lru_next = chunk->lru_next;
+    chunk->lru_next->lru_prev = chunk->lru_prev;
+}
+
+static void
+_pd_lru_push_front(_pd_chunk_cache *shard, _pd_chunk *chunk)
+{
+    chunk->lru_prev = &shard->lru;
+    chunk->lru_next = shard->lru.lru_next;
+    shard->lru.lru_next->lru_prev = chunk;
+    shard->lru.lru_next = chunk;
+}
+
+static uint32_t
+_pd_chunk_hash(uint64_t dict_serial, int chunk_id)
+{
+    uint64_t h = (dict_serial << 32 ^ (uint32_t)chunk_id)
+        * 0x9e3779b97f4a7c15ull;
+    return h >> 32;
+}
+
+static _pd_chunk_cache *
+_pd_cache_shard(pd_cache *cache, uint64_t dict_serial, int chunk_id)
+{
+    uint32_t h = _pd_chunk_hash(dict_serial, chunk_id);
+    return &cache->shards[h % cache->shard_count];
+}
+
+static _pd_chunk **
+_pd_chunk_cache_bucket(_pd_chunk_cache *shard, uint64_t dict_serial,
+                       int chunk_id)
+{
+    /* Low bits of hash are used for selecting shard, so take high ones */
+    uint32_t h = _pd_chunk_hash(dict_serial, chunk_id);
+    return &shard->buckets[(h >> 16) & shard->bucket_mask];
+}
+
+static void
+_pd_chunk_cache_unlink(_pd_chunk_cache *shard, _pd_chunk *chunk)
+{
+    _pd_lru_unlink(chunk);
+
+    _pd_chunk **p = _pd_chunk_cache_bucket(shard, chunk->dict_serial,
+                                           chunk->id);
+    while (*p != chunk)
+        p = &(*p)->hash_next;
+    *p = chunk->hash_next;
+
+    shard->count--;
+    shard->size -= chunk->size;
+}
+
+/*
+ * Doubles number of hash table buckets once there are more chunks than
+ * buckets. Failure to grow is not fatal, lookups just get slower.
+ */
+static void
+_pd_chunk_cache_grow(_pd_chunk_cache *shard)
+{
+    size_t buckets = (shard->bucket_mask + 1) * 2;
+    _pd_chunk **new_buckets = calloc(buckets, sizeof(_pd_chunk *));
+    if (!new_buckets)
+        return;
+
+    free(shard->buckets);
+    shard->buckets = new_buckets;
+    shard->bucket_mask = buckets - 1;
+
+    for (_pd_chunk *chunk = shard->lru.lru_next; chunk != &shard->lru;
+         chunk = chunk->lru_next) {
+        _pd_chunk **bucket =
+            _pd_chunk_cache_bucket(shard, chunk->dict_serial, chunk->id);
+        chunk->hash_next = *bucket;
+        *bucket = chunk;
+    }
+}
+
+/*
+ * Looks chunk up in cache and marks it as most recently used. Should be
+ * called with cache shard locked, returned chunk is valid until shard is
+ * unlocked.
+ */
+static _pd_chunk *
+_pd_chunk_cache_lookup(_pd_chunk_cache *shard, uint64_t dict_serial,
+                       int chunk_id)
+{
+    for (_pd_chunk *chunk = *_pd_chunk_cache_bucket(shard, dict_serial,
+                                                    chunk_id);
+         chunk; chunk = chunk->hash_next)
+        if (chunk->id == chunk_id && chunk->dict_serial == dict_serial) {
+            _pd_lru_unlink(chunk);
+            _pd_lru_push_front(shard, chunk);
+            return chunk;
+        }
+    return NULL;
+}
+
+/*
+ * Inserts chunk into cache, evicting least recently used unpinned chunks to
+ * fit into budget. Should be called with cache shard locked. Returns number of
+ * evicted chunks.
+ *
+ * Every shard keeps at least one chunk, however small its budget is. If too
+ * many chunks are pinned, shard may temporarily exceed its budget.
+ */
+static int
+_pd_chunk_cache_insert(_pd_chunk_cache *shard, _pd_chunk *chunk)
+{
+    int evicted = 0;
+    _pd_chunk *victim = shard->lru.lru_prev;
+    while (shard->size + chunk->size > shard->budget && victim != &shard->lru) {
+        _pd_chunk *prev = victim->lru_prev;
+        if (!victim->pins) {
+            _pd_chunk_cache_unlink(shard, victim);
+            free(victim);
+            shard->evictions++;
+            evicted++;
+        }
+        victim = prev;
+    }
+
+    if (shard->count > shard->bucket_mask)
+        _pd_chunk_cache_grow(shard);
+
+    _pd_chunk **bucket =
+        _pd_chunk_cache_bucket(shard, chunk->dict_serial, chunk->id);
+    chunk->hash_next = *bucket;
+    *bucket = chunk;
+    _pd_lru_push_front(shard, chunk);
+    shard->count++;
+    shard->size += chunk->size;
+    return evicted;
+}
+
+void
+pd_cache_get_stats(pd_cache *cache, pd_cache_stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    for (size_t i = 0; i < cache->shard_count; ++i) {
+        _pd_chunk_cache *shard = &cache->shards[i];
+        pthread_mutex_lock(&shard->lock);
+        stats->hits += shard->hits;
+        stats->misses += shard->misses;
+        stats->evictions += shard->evictions;
+        stats->chunks += shard->count;
+        stats->size += shard->size;
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
+
+/*
+ * Drops all chunks of dictionary from cache.
+ */
+static void
+_pd_chunk_cache_purge(pd_cache *cache, uint64_t dict_serial)
+{
+    for (size_t i = 0; i < cache->shard_count; ++i) {
+        _pd_chunk_cache *shard = &cache->shards[i];
+        pthread_mutex_lock(&shard->lock);
+        _pd_chunk *chunk = shard->lru.lru_next;
+        while (chunk != &shard->lru) {
+            _pd_chunk *next = chunk->lru_next;
+            if (chunk->dict_serial == dict_serial) {
+                _pd_chunk_cache_unlink(shard, chunk);
+                free(chunk);
+            }
+            chunk = next;
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
+
+/*
+ * Returns pinned chunk, decompressing and caching it if necessary. Chunk
+ * should be unpinned by _pd_chunk_unpin() once its data is not needed.
+ *
+ * Chunk is decompressed without holding the lock, so other threads may use
+ * the cache meanwhile. If two threads decompress the same chunk at the same
+ * time, the result of the second one is dropped.
+ */
+/* Set in prefetch thread */
+static __thread bool _pd_prefetching;
+
+static _pd_chunk *
+_pd_chunk_pin(pd_dictionary *dict, int chunk_id)
+{
+    _pd_chunk_cache *shard =
+        _pd_cache_shard(dict->cache, dict->serial, chunk_id);
+
+    /* Chunk being inflated by prefetch thread is better waited for */
+    if (dict->prefetch_pool && !_pd_prefetching
+        && __atomic_load_n(&dict->prefetch_chunk, __ATOMIC_RELAXED)
+           == chunk_id) {
+        pthread_mutex_lock(&dict->prefetch_lock);
+        while (dict->prefetch_chunk == chunk_id)
+            pthread_cond_wait(&dict->prefetch_done, &dict->prefetch_lock);
+        pthread_mutex_unlock(&dict->prefetch_lock);
+    }
+
+    pthread_mutex_lock(&shard->lock);
+    _pd_chunk *chunk = _pd_chunk_cache_lookup(shard, dict->serial, chunk_id);
+    if (chunk) {
+        chunk->pins++;
+        shard->hits++;
+        pthread_mutex_unlock(&shard->lock);
+        STAT_ADD(dict, cache_hits, 1);
+        return chunk;
+    }
+    shard->misses++;
+    pthread_mutex_unlock(&shard->lock);
+    STAT_ADD(dict, cache_misses, 1);
+
+    size_t chunk_size = _pd_chunk_size(dict);
+    chunk = malloc(chunk_size);
+    if (!chunk)
+        return NULL;
+    chunk->dict_serial = dict->serial;
+    chunk->id = chunk_id;
+    chunk->pins = 1;
+    chunk->size = chunk_size;
+
+    if (dict->store && _pd_chunk_store_read(dict->store, chunk_id,
+                                            chunk->data)) {
+        STAT_ADD(dict, store_hits, 1);
+    } else {
+        size_t size;
+        if (!_uncompress_chunk(dict, chunk_id, chunk->data, &size)) {
+            free(chunk);
+            return NULL;
+        }
+        if (dict->store)
+            _pd_chunk_store_write(dict->store, chunk_id, chunk->data, size);
+    }
+
+    int evicted = 0;
+    pthread_mutex_lock(&shard->lock);
+    _pd_chunk *cached = _pd_chunk_cache_lookup(shard, dict->serial, chunk_id);
+    if (cached) {
+        free(chunk);
+        chunk = cached;
+        chunk->pins++;
+    } else {
+        evicted = _pd_chunk_cache_insert(shard, chunk);
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    if (evicted)
+        STAT_ADD(dict, cache_evictions, evicted);
+
+    return chunk;
+}
+
+static void
+_pd_chunk_unpin(pd_dictionary *dict, _pd_chunk *chunk)
+{
+    _pd_chunk_cache *shard =
+        _pd_cache_shard(dict->cache, chunk->dict_serial, chunk->id);
+
+    pthread_mutex_lock(&shard->lock);
+    chunk->pins--;
+    pthread_mutex_unlock(&shard->lock);
+}
+
+/*
+ * Copies size bytes starting from offset in given chunk to out.
+ */
+static bool
+_read_chunk(pd_dictionary *dict, int chunk_id, size_t offset, char *out,
+            size_t size)
+{
+    _pd_chunk *chunk = _pd_chunk_pin(dict, chunk_id);
+    if (!chunk)
+        return false;
+
+    memcpy(out, chunk->data + offset, size);
+    _pd_chunk_unpin(dict, chunk);
+    return true;
+}
+
+/* -- Index lines -- */
+
+static bool
+_is_base64_sym(int c)
+{
+    return ('A' <= c && c <= 'Z')
+        || ('a' <= c && c <= 'z')
+        || ('0' <= c && c <= '9')
+        || c == '+' || c == '/';
+}
+
+static unsigned
+_base64_decode(const char *str)
+{
+    unsigned n = 0;
+    for (char c = *str++; _is_base64_sym(c); c = *str++) {
+        n <<= 6;
+        if ('A' <= c && c <= 'Z') n += c - 'A';
+        else if ('a' <= c && c <= 'z') n += c - 'a' + 26;
+        else if ('0' <= c && c <= '9') n += c - '0' + 52;
+        else if (c == '+') n += 62;
+        else if (c == '/') n += 63;
+    }
+    return n;
+}
+
+typedef struct {
+    const char *name;
+    const char *endname;
+    size_t article_offset;
+    size_t article_length;
+
+    const char *nextline;
+} pd_index_line;
+
+static pd_index_line
+_parse_index_line(const char *line, const char *end)
+{
+    pd_index_line ret = {};
+    /* <name> \t <pos> \t <len> \n
+     * ^      ^  ^     ^  ^     ^
+     * |      |  |     |  |     |
+     * |      |  pos   |  len   endlen
+     * |      |        |
+     * name   endname  endpos
+     *
+     * <pos> and <len> are base64-encoded strings
+     */
+    const char *name = line;
+    const char *endname = line;
+    while (endname < end && *endname != '\t') endname++;
+    if (endname == end || endname == name)
+        return ret;
+    const char *pos = endname + 1;
+    const char *endpos = pos;
+    while (endpos < end && _is_base64_sym(*endpos)) endpos++;
+    if (endpos == end || endpos == pos || *endpos != '\t')
+        return ret;
+    const char *len = endpos + 1;
+    const char *endlen = len;
+    while (endlen < end && _is_base64_sym(*endlen)) endlen++;
+    if (endlen == end || endlen == len || *endlen != '\n')
+        return ret;
+
+    ret.name = line;
+    ret.endname = endname;
+    ret.article_offset = _base64_decode(pos);
+    ret.article_length = _base64_decode(len);
+    ret.nextline = endlen + 1;
+    return ret;
+}
+
+/* -- Prefetch -- */
+
+/*
+ * Articles found by prefix search are usually stored one after another in
+ * data file, so reading them one by one inflates chunk after chunk. With
+ * prefetch, chunks needed for articles of result are inflated into cache by
+ * background thread of dictionary as soon as result is found, so reading
+ * does not wait for inflation. Plain data files are just advised to kernel
+ * to be read ahead.
+ */
+
+static void
+_pd_prefetch_init(pd_dictionary *dict)
+{
+    if (!dict->compressed) {
+        dict->prefetch = true;
+        return;
+    }
+
+    /* Leave half of cache to chunks being read */
+    size_t budget = 0;
+    for (size_t i = 0; i < dict->cache->shard_count; ++i)
+        budget += dict->cache->shards[i].budget;
+    dict->prefetch_chunks = budget / _pd_chunk_size(dict) / 2;
+    if (dict->prefetch_chunks > PREFETCH_MAX_CHUNKS)
+        dict->prefetch_chunks = PREFETCH_MAX_CHUNKS;
+
+    if (dict->prefetch_chunks == 0)
+        return;
+
+    pthread_mutex_init(&dict->prefetch_lock, NULL);
+    pthread_cond_init(&dict->prefetch_done, NULL);
+    dict->prefetch_chunk = -1;
+    dict->prefetch_pool = _pd_pool_new(1);
+    if (!dict->prefetch_pool) {
+        pthread_cond_destroy(&dict->prefetch_done);
+        pthread_mutex_destroy(&dict->prefetch_lock);
+        return;
+    }
+    dict->prefetch = true;
+}
+
+static void
+_pd_prefetch_set_chunk(pd_dictionary *dict, int chunk_id)
+{
+    pthread_mutex_lock(&dict->prefetch_lock);
+    __atomic_store_n(&dict->prefetch_chunk, chunk_id, __ATOMIC_RELAXED);
+    pthread_cond_broadcast(&dict->prefetch_done);
+    pthread_mutex_unlock(&dict->prefetch_lock);
+}
+
+static void
+_pd_willneed(const void *start, size_t size)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    uintptr_t begin = (uintptr_t)start & ~(uintptr_t)(page - 1);
+    madvise((void *)begin, (uintptr_t)start + size - begin, MADV_WILLNEED);
+}
+
+typedef struct {
+    pd_dictionary *dict;
+    size_t first;
+    size_t last;
+} _pd_prefetch_task;
+
+static void
+_pd_prefetch_run(void *arg)
+{
+    _pd_prefetch_task *task = arg;
+    pd_dictionary *dict = task->dict;
+
+    _pd_prefetching = true;
+    for (size_t id = task->first; id <= task->last; ++id) {
+        if (__atomic_load_n(&dict->closing, __ATOMIC_RELAXED))
+            break;
+        _pd_prefetch_set_chunk(dict, id);
+        _pd_chunk *chunk = _pd_chunk_pin(dict, id);
+        if (chunk)
+            _pd_chunk_unpin(dict, chunk);
+    }
+    _pd_prefetch_set_chunk(dict, -1);
+
+    __sync_sub_and_fetch(&dict->prefetch_pending, 1);
+    free(task);
+}
+
+/*
+ * Starts reading ahead data of articles of lines in [lower, upper).
+ */
+static void
+_pd_prefetch(pd_dictionary *dict, const char *lower, const char *upper)
+{
+    if (!dict->prefetch)
+        return;
+
+    size_t first = SIZE_MAX;
+    size_t last = 0;
+    const char *line = lower;
+    for (int i = 0; line < upper && i < PREFETCH_MAX_LINES; ++i) {
+        pd_index_line l = _parse_index_line(line, upper);
+        if (!l.name)
+            break;
+        if (l.article_length) {
+            if (l.article_offset < first)
+                first = l.article_offset;
+            if (l.article_offset + l.article_length > last)
+                last = l.article_offset + l.article_length;
+        }
+        line = l.nextline;
+    }
+    if (first >= last)
+        return;
+
+    if (!dict->compressed) {
+        if (last <= dict->data_size)
+            _pd_willneed((char *)dict->data + first, last - first);
+        return;
+    }
+    if (!dict->prefetch_pool)
+        return;
+
+    /* The first chunk is going to be read right away */
+    size_t first_chunk = first / dict->chunk_length + 1;
+    size_t last_chunk = (last - 1) / dict->chunk_length;
+    if (last_chunk >= dict->chunk_count)
+        last_chunk = dict->chunk_count - 1;
+    if (first_chunk > last_chunk)
+        return;
+    if (last_chunk - first_chunk >= dict->prefetch_chunks)
+        last_chunk = first_chunk + dict->prefetch_chunks - 1;
+
+    if (__sync_add_and_fetch(&dict->prefetch_pending, 1)
+        > PREFETCH_MAX_PENDING)
+        goto drop;
+
+    _pd_prefetch_task *task = malloc(sizeof(_pd_prefetch_task));
+    if (!task)
+        goto drop;
+    task->dict = dict;
+    task->first = first_chunk;
+    task->last = last_chunk;
+
+    _pd_willneed((char *)dict->data + dict->chunk_offsets[first_chunk],
+                 dict->chunk_offsets[last_chunk + 1]
+                 - dict->chunk_offsets[first_chunk]);
+
+    if (!_pd_pool_submit(dict->prefetch_pool, _pd_prefetch_run, task)) {
+        free(task);
+        goto drop;
+    }
+    return;
+
+drop:
+    __sync_sub_and_fetch(&dict->prefetch_pending, 1);
+}
+
+/* -- Opening and closing -- */
+
+pd_dictionary *
+pd_open(const char *index_file, const char *data_file, pd_sort_mode mode)
+{
+    return pd_open_ext(index_file, data_file, mode, NULL);
+}
+
+pd_dictionary *
+pd_open_ext(const char *index_file, const char *data_file, pd_sort_mode mode,
+            const pd_open_options *options)
+{
+    pd_open_options defaults = {};
+    if (!options)
+        options = &defaults;
+
+    pd_dictionary *dict = calloc(1, sizeof(pd_dictionary));
+    if (!dict)
+        return NULL;
+
+    pthread_once(&_pd_fold_prefix_once, _pd_fold_prefix_init);
+
+    dict->mode = mode;
+    dict->fold_simd = _pd_fold_prefix && _pd_locale_folds_ascii();
+
+    struct stat index_st;
+    dict->index = _mmap_ro(index_file, &dict->index_size, &index_st);
+    if (!dict->index)
+        goto err;
+
+    _pd_load_line_table(dict, index_file, &index_st);
+    _pd_load_trie(dict, index_file, &index_st);
+    _pd_load_phash(dict, index_file, &index_st);
+    _pd_load_bloom(dict, index_file, &index_st);
+
+    if ((options->flags & PICODICT_OPEN_NORMALIZED_KEYS)
+        && mode >= 0 && mode < SORT_COUNT)
+        _pd_build_keys(dict);
+
+    struct stat data_st;
+    dict->data = _mmap_ro(data_file, &dict->data_size, &data_st);
+    if (!dict->data)
+        goto err2;
+
+    dz_parse_result res = _parse_dz_header(dict, dict->data, dict->data_size);
+    if (res == DZ_ERROR)
+        goto err3;
+
+    if (res == DZ_OK) {
+        pthread_mutex_init(&dict->inflaters_lock, NULL);
+
+        /* Check that decompression works at all */
+        _pd_inflater *inf = _pd_inflater_get(dict);
+        if (!inf)
+            goto err4;
+        _pd_inflater_put(dict, inf);
+
+        dict->serial = __sync_add_and_fetch(&_pd_next_serial, 1);
+
+        if (options->cache) {
+            dict->cache = _pd_cache_ref(options->cache);
+        } else {
+            size_t cache_size = options->cache_size;
+            if (cache_size == 0)
+                cache_size = CHUNK_CACHE_SIZE * _pd_chunk_size(dict);
+            dict->cache = pd_cache_new(cache_size, options->concurrency);
+            if (!dict->cache)
+                goto err5;
+        }
+
+        dict->compressed = true;
+    }
+
+    if (dict->compressed && (options->flags & (PICODICT_OPEN_CHUNK_STORE
+                                               | PICODICT_OPEN_SHARED_CHUNKS)))
+        dict->store = _pd_chunk_store_open(dict, data_file, &data_st, options);
+
+    if (options->flags & PICODICT_OPEN_PREFETCH)
+        _pd_prefetch_init(dict);
+
+    return dict;
+
+err5:
+    _pd_inflaters_free(dict);
+err4:
+    pthread_mutex_destroy(&dict->inflaters_lock);
+err3:
+    free(dict->chunk_offsets);
+    munmap(dict->data, dict->data_size);
+err2:
+    _pd_free_keys(dict);
+    if (dict->bloom_file)
+        munmap(dict->bloom_file, dict->bloom_file_size);
+    if (dict->phash_file)
+        munmap(dict->phash_file, dict->phash_file_size);
+    if (dict->trie_file)
+        munmap(dict->trie_file, dict->trie_file_size);
+    if (dict->lines_file)
+        munmap(dict->lines_file, dict->lines_file_size);
+    munmap(dict->index, dict->index_size);
+err:
+    free(dict);
+    return NULL;
+}
+
+void
+pd_close(pd_dictionary *dict)
+{
+    if (dict->async_pool)
+        _pd_pool_free(dict->async_pool);
+
+    if (dict->prefetch_pool) {
+        __atomic_store_n(&dict->closing, true, __ATOMIC_RELAXED);
+        _pd_pool_free(dict->prefetch_pool);
+        pthread_cond_destroy(&dict->prefetch_done);
+        pthread_mutex_destroy(&dict->prefetch_lock);
+    }
+
+    munmap(dict->index, dict->index_size);
+    munmap(dict->data, dict->data_size);
+
+    if (dict->lines_file)
+        munmap(dict->lines_file, dict->lines_file_size);
+    if (dict->trie_file)
+        munmap(dict->trie_file, dict->trie_file_size);
+    if (dict->bloom_file)
+        munmap(dict->bloom_file, dict->bloom_file_size);
+    if (dict->phash_file)
+        munmap(dict->phash_file, dict->phash_file_size);
+    _pd_free_keys(dict);
+
+    if (dict->store)
+        _pd_chunk_store_close(dict->store);
+
+    if (dict->compressed) {
+        free(dict->chunk_offsets);
+        _pd_inflaters_free(dict);
+        pthread_mutex_destroy(&dict->inflaters_lock);
+        _pd_chunk_cache_purge(dict->cache, dict->serial);
+        pd_cache_free(dict->cache);
+    }
+
+    free(dict);
+}
+
+/* -- Resultset -- */
+
+static int
+_min(size_t a, size_t b)
+{
+    return a < b ? a : b;
+}
+
+static char *
+_read_compressed(pd_dictionary *dict, size_t offset, size_t size)
+{
+    char *data = malloc(sizeof(char) * size);
+    if (!data)
+        return NULL;
+    size_t data_offset = 0;
+
+    while (size) {
+        int chunk_id = offset / dict->chunk_length;
+        size_t offset_in_chunk = offset % dict->chunk_length;
+        size_t to_copy = _min(dict->chunk_length - offset_in_chunk, size);
+        if (!_read_chunk(dict, chunk_id, offset_in_chunk, data + data_offset,
+                         to_copy)) {
+            free(data);
+            return NULL;
+        }
+
+        offset += to_copy;
+        size -= to_copy;
+        data_offset += to_copy;
+    }
+
+    return data;
+}
+
+static pd_result *
+_make_pd_result(pd_dictionary *d, _pd_interval i)
+{
+    pd_result *res = calloc(1, sizeof(pd_result));
+    if (!res)
+        return NULL;
+    res->dict = d;
+    res->result = i;
+    return res;
+}
+
+static void
+_pd_match_list_unref(_pd_match_list *list)
+{
+    if (list && __sync_sub_and_fetch(&list->refcount, 1) == 0)
+        free(list);
+}
 
-    dict->chunk_length = le16toh(*(unsigned short *)(file + 18));
-    dict->chunk_count = le16toh(*(unsigned short *)(file + 20));
+/*
+ * Makes result for n-th line of list of matches.
+ */
+static pd_result *
+_make_pd_match(pd_dictionary *d, _pd_match_list *list, size_t n)
+{
+    _pd_interval i = {
+        .lower = list->lines[n],
+        .upper = _nextline(list->lines[n]),
+    };
+    pd_result *res = _make_pd_result(d, i);
+    if (res) {
+        __sync_add_and_fetch(&list->refcount, 1);
+        res->matches = list;
+        res->match = n;
+    }
+    return res;
+}
 
-    /* skipping various header stuff */
+static _pd_interval
+_advance_to_next_entry(_pd_interval i)
+{
+    _pd_interval ret = {
+        .lower = _nextline(i.lower),
+        .upper = i.upper
+    };
+    return ret;
+}
 
-    int data_offset = 12 + xlen; /* header + extra header */
-    if (flags & GZIP_FNAME) {
-        while (data_offset < size && file[data_offset] != '\0') data_offset++;
-        data_offset++;
-        if (data_offset >= size)
-            return DZ_ERROR;
+char *
+pd_name(pd_dictionary *d)
+{
+    _pd_interval i = _pd_search_casecmp(d, "00-database-short");
+    if (i.lower == i.upper) {
+        i = _pd_search_casecmp(d, "00databaseshort");
+        if (i.lower == i.upper) {
+            return NULL;
+        }
     }
-    if (flags & GZIP_FCOMMENT) {
-        while (data_offset < size && file[data_offset] != '\0') data_offset++;
-        data_offset++;
-        if (data_offset >= size)
-            return DZ_ERROR;
+
+    pd_result *res = _make_pd_result(d, i);
+
+    size_t size;
+    const char *article = pd_result_article(res, &size);
+
+    char *str;
+    if (!strncmp(article, "00-database-short\n", 18)
+        || !strncmp(article, "00databaseshort\n", 16)) {
+        /* Skip first line and indentation */
+        const char *nl = _nextline(article);
+        while (isspace(*nl)) nl++;
+        const char *endl = strchr(nl, '\n');
+
+        str = malloc(endl - nl + 1);
+        strncpy(str, nl, endl - nl);
+        str[endl - nl] = '\0';
+    } else {
+        /* Whole article is description */
+        str = malloc(size + 1);
+        strncpy(str, article, size);
+        str[size] = '\0';
+    }
+
+    pd_result_free(res);
+
+    return str;
+}
+
+
+/*
+ * Returns search functions of dictionary for given find mode, or NULL if sort
+ * mode of dictionary is not known.
+ */
+static const _pd_searcher *
+_pd_get_searcher(const pd_dictionary *d, pd_find_mode options)
+{
+    if (d->mode < 0 || d->mode >= SORT_COUNT)
+        return NULL;
+    if (options != PICODICT_FIND_EXACT)
+        options = PICODICT_FIND_STARTS_WITH;
+
+    if (d->mode == PICODICT_SORT_ALPHABET && d->fold_simd)
+        return &_pd_searchers_simd[options];
+    return &_pd_searchers[d->mode][options];
+}
+
+/* -- Fuzzy search -- */
+
+/*
+ * Fuzzy search looks for headwords within small Levenshtein distance from
+ * query, comparing normalized headwords (see _pd_normalize()) with
+ * normalized query.
+ *
+ * Index is walked in order, and row of distance matrix is computed for every
+ * symbol of headword. Rows for common prefix of subsequent headwords are
+ * reused, so most headwords cost a couple of rows. Once all values of row
+ * exceed maximum distance, no headword with this prefix may match, and the
+ * whole range of such headwords is skipped with binary search.
+ *
+ * Symbols are bytes, or code points for UTF-8 sort modes.
+ */
+
+/* Queries this long or shorter are allowed one edit, longer ones two */
+#define FUZZY_SHORT_QUERY 4
+
+/* Initial size in bytes of window skipped headwords are looked for in */
+#define FUZZY_GALLOP_STEP 256
+
+static bool
+_pd_mode_is_utf8(pd_sort_mode mode)
+{
+    return mode == PICODICT_SORT_ALPHABET_UTF8
+        || mode == PICODICT_SORT_SKIPUNALPHA_UTF8;
+}
+
+/*
+ * Splits normalized string into symbols. Stores symbols and offsets of their
+ * ends to given arrays, which should fit len entries, and returns number of
+ * symbols.
+ */
+static size_t
+_pd_symbols(pd_sort_mode mode, const unsigned char *str, size_t len,
+            uint32_t *symbols, size_t *ends)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < len; n++) {
+        uint32_t c;
+        unsigned l;
+        if (_pd_mode_is_utf8(mode) && str[i] >= 0x80
+            && (l = _pd_utf8_decode(str + i, &c)) && i + l <= len) {
+            symbols[n] = c;
+            i += l;
+        } else {
+            /* Bytes outside of UTF-8 sequences don't clash with code points */
+            symbols[n] = _pd_mode_is_utf8(mode) && str[i] >= 0x80
+                       ? 0x110000 + str[i] : str[i];
+            i++;
+        }
+        ends[n] = i;
+    }
+    return n;
+}
+
+typedef struct {
+    const char *line;
+    unsigned distance;
+} _pd_fuzzy_match;
+
+static int
+_pd_fuzzy_match_cmp(const void *lhs, const void *rhs)
+{
+    const _pd_fuzzy_match *l = lhs;
+    const _pd_fuzzy_match *r = rhs;
+    if (l->distance != r->distance)
+        return l->distance < r->distance ? -1 : 1;
+    return l->line < r->line ? -1 : l->line > r->line;
+}
+
+typedef struct {
+    /* Normalized headword, its symbols and offsets of their ends */
+    unsigned char *key;
+    uint32_t *symbols;
+    size_t *ends;
+    size_t allocated;
+} _pd_fuzzy_key;
+
+static bool
+_pd_fuzzy_key_reserve(_pd_fuzzy_key *k, size_t len)
+{
+    size_t size = PD_NORMALIZED_MAX(len) + 1;
+    if (size <= k->allocated)
+        return true;
+
+    unsigned char *key = realloc(k->key, size);
+    if (key)
+        k->key = key;
+    uint32_t *symbols = realloc(k->symbols, size * sizeof(uint32_t));
+    if (symbols)
+        k->symbols = symbols;
+    size_t *ends = realloc(k->ends, size * sizeof(size_t));
+    if (ends)
+        k->ends = ends;
+    if (!key || !symbols || !ends)
+        return false;
+
+    k->allocated = size;
+    return true;
+}
+
+static pd_result *
+_pd_find_fuzzy(pd_dictionary *d, const _pd_searcher *searcher,
+               const char *text)
+{
+    STAT_ADD(d, lookups, 1);
+
+    pd_result *res = NULL;
+    _pd_fuzzy_key prev = {}, cur = {}, query = {};
+    unsigned *rows = NULL;
+    _pd_fuzzy_match *matches = NULL;
+    size_t match_count = 0;
+    size_t match_allocated = 0;
+
+    size_t text_len = strcspn(text, "\t");
+    if (!_pd_fuzzy_key_reserve(&query, text_len))
+        goto out;
+    size_t query_bytes = _pd_normalize(d->mode, (const unsigned char *)text,
+                                       text_len, query.key);
+    size_t m = _pd_symbols(d->mode, query.key, query_bytes,
+                           query.symbols, query.ends);
+
+    unsigned max_distance = m <= FUZZY_SHORT_QUERY ? 1 : 2;
+
+    /* Headwords longer than this are too far from query */
+    size_t max_depth = m + max_distance;
+    rows = malloc((max_depth + 1) * (m + 1) * sizeof(unsigned));
+    if (!rows)
+        goto out;
+#define ROW(depth) (rows + (depth) * (m + 1))
+
+    for (size_t j = 0; j <= m; ++j)
+        ROW(0)[j] = j;
+
+    /* Number of rows valid for prev */
+    size_t prev_depth = 0;
+    /* Number of symbols of prev no matching headword starts with, if any */
+    size_t pruned_depth = 0;
+
+    const char *index_end = (const char *)d->index + d->index_size;
+    for (const char *line = d->index; line < index_end;) {
+        const char *next = memchr(line, '\n', index_end - line);
+        next = next ? next + 1 : index_end;
+        const char *tab = memchr(line, '\t', next - line);
+        const char *name_end = tab ? tab : next;
+
+        _pd_search_counters.probes++;
+
+        if (!_pd_fuzzy_key_reserve(&cur, name_end - line))
+            goto out;
+        size_t bytes = _pd_normalize(d->mode, (const unsigned char *)line,
+                                     name_end - line, cur.key);
+        size_t len = _pd_symbols(d->mode, cur.key, bytes,
+                                 cur.symbols, cur.ends);
+
+        /* Rows for common prefix with previous headword are still valid */
+        size_t depth = 0;
+        while (depth < prev_depth && depth < len
+               && cur.symbols[depth] == prev.symbols[depth])
+            depth++;
+
+        if (pruned_depth && depth >= pruned_depth) {
+            /*
+             * Previous headword has shown that no headword starting with its
+             * first pruned_depth symbols matches, and this one starts with
+             * them too: skip all such headwords at once. Range is not looked
+             * for right away, as usually next headword is already a different
+             * one.
+             */
+            size_t end = prev.ends[pruned_depth - 1];
+            unsigned char saved = prev.key[end];
+            prev.key[end] = '\0';
+            /* Skipped ranges are mostly short: gallop instead of bisecting */
+            size_t step = FUZZY_GALLOP_STEP;
+            for (;;) {
+                const char *bound = next + step < index_end
+                                  ? _nextline(next + step) : index_end;
+                _pd_interval skip = searcher->search_range(
+                    (const char *)prev.key, next, bound);
+                if (skip.upper < bound || bound == index_end) {
+                    next = skip.upper;
+                    break;
+                }
+                next = bound;
+                step *= 4;
+            }
+            prev.key[end] = saved;
+            line = next;
+            continue;
+        }
+
+        bool pruned = false;
+        size_t last = len < max_depth ? len : max_depth;
+        for (; depth < last; ++depth) {
+            unsigned *up = ROW(depth);
+            unsigned *row = ROW(depth + 1);
+            unsigned row_min = row[0] = depth + 1;
+            for (size_t j = 1; j <= m; ++j) {
+                unsigned v = up[j - 1]
+                    + (cur.symbols[depth] != query.symbols[j - 1]);
+                if (up[j] + 1 < v)
+                    v = up[j] + 1;
+                if (row[j - 1] + 1 < v)
+                    v = row[j - 1] + 1;
+                row[j] = v;
+                if (v < row_min)
+                    row_min = v;
+            }
+
+            if (row_min > max_distance) {
+                pruned = true;
+                depth++;
+                break;
+            }
+        }
+
+        /* Headwords following this one with same first symbols are longer */
+        if (len > max_depth)
+            pruned = true;
+
+        if (!pruned && len <= max_depth && ROW(len)[m] <= max_distance
+            && strncmp("00database", line, 10)
+            && strncmp("00-database-", line, 12)) {
+            if (match_count == match_allocated) {
+                match_allocated = match_allocated ? match_allocated * 2 : 16;
+                _pd_fuzzy_match *mm =
+                    realloc(matches, match_allocated * sizeof(*matches));
+                if (!mm)
+                    goto out;
+                matches = mm;
+            }
+            matches[match_count].line = line;
+            matches[match_count].distance = ROW(len)[m];
+            match_count++;
+        }
+
+        pruned_depth = pruned ? depth : 0;
+
+        /* cur becomes prev */
+        _pd_fuzzy_key tmp = prev;
+        prev = cur;
+        cur = tmp;
+        prev_depth = depth;
+        line = next;
+    }
+#undef ROW
+
+    if (match_count == 0)
+        goto out;
+
+    qsort(matches, match_count, sizeof(_pd_fuzzy_match), _pd_fuzzy_match_cmp);
+
+    _pd_match_list *list = malloc(sizeof(_pd_match_list)
+                                  + match_count * sizeof(const char *));
+    if (!list)
+        goto out;
+    list->refcount = 1;
+    list->count = match_count;
+    for (size_t i = 0; i < match_count; ++i)
+        list->lines[i] = matches[i].line;
+
+    res = _make_pd_match(d, list, 0);
+    _pd_match_list_unref(list);
+
+out:
+    _pd_search_counters_flush(d);
+    free(matches);
+    free(rows);
+    free(prev.key); free(prev.symbols); free(prev.ends);
+    free(cur.key); free(cur.symbols); free(cur.ends);
+    free(query.key); free(query.symbols); free(query.ends);
+    return res;
+}
+
+/*
+ * Looks text up using the fastest structure available.
+ */
+static _pd_interval
+_pd_find(pd_dictionary *d, const _pd_searcher *searcher, const char *text,
+         pd_find_mode options)
+{
+    STAT_ADD(d, lookups, 1);
+
+    _pd_interval i;
+    if (options == PICODICT_FIND_EXACT && d->phash_slots) {
+        i = _pd_phash_search(d, searcher, text);
+    } else if (options == PICODICT_FIND_EXACT && d->bloom
+               && !_pd_bloom_check(d, text)) {
+        STAT_ADD(d, filtered, 1);
+        i.lower = i.upper = d->index;
+    } else if (d->trie)
+        i = _pd_trie_search(d, searcher, text, options);
+    else if (d->keys)
+        _pd_search_keys(d, &text, 1, options, &i);
+    else
+        i = searcher->search(d, text);
+    return i;
+}
+
+pd_result *
+pd_find(pd_dictionary *d, const char *text, pd_find_mode options)
+{
+    const _pd_searcher *searcher = _pd_get_searcher(d, options);
+    if (!searcher)
+        return NULL;
+
+    if (options == PICODICT_FIND_FUZZY)
+        return _pd_find_fuzzy(d, searcher, text);
+
+    _pd_interval i = _pd_find(d, searcher, text, options);
+    if (i.lower == i.upper)
+        return NULL;
+
+    _pd_prefetch(d, i.lower, i.upper);
+    return _make_pd_result(d, i);
+}
+
+size_t
+pd_complete(pd_dictionary *d, const char *prefix, size_t k,
+            pd_headword *out_headwords)
+{
+    const _pd_searcher *searcher =
+        _pd_get_searcher(d, PICODICT_FIND_STARTS_WITH);
+    if (!searcher || k == 0)
+        return 0;
+
+    _pd_interval i = _pd_find(d, searcher, prefix, PICODICT_FIND_STARTS_WITH);
+
+    size_t count = 0;
+    for (const char *line = i.lower; line < i.upper && count < k;
+         line = _nextline(line)) {
+        /* Skip special headwords */
+        if (!strncmp("00database", line, 10)
+            || !strncmp("00-database-", line, 12))
+            continue;
+
+        const char *tab = memchr(line, '\t', i.upper - line);
+        if (!tab)
+            break;
+        out_headwords[count].headword = line;
+        out_headwords[count].length = tab - line;
+        count++;
+    }
+    return count;
+}
+
+typedef struct {
+    const char *word;
+    size_t pos;
+    _pd_cmp cmp;
+} _pd_batch_item;
+
+static int
+_pd_batch_item_cmp(const void *lhs, const void *rhs)
+{
+    const _pd_batch_item *l = lhs;
+    const _pd_batch_item *r = rhs;
+    int c = (*l->cmp)(l->word, r->word);
+    if (c)
+        return c;
+    return l->pos < r->pos ? -1 : l->pos > r->pos;
+}
+
+size_t
+pd_find_batch(pd_dictionary *d, const char **words, size_t n,
+              pd_find_mode options, pd_result **results)
+{
+    memset(results, 0, n * sizeof(pd_result *));
+
+    const _pd_searcher *searcher = _pd_get_searcher(d, options);
+    if (!searcher || n == 0)
+        return 0;
+
+    size_t count = 0;
+    if (options == PICODICT_FIND_FUZZY) {
+        for (size_t i = 0; i < n; ++i)
+            if ((results[i] = _pd_find_fuzzy(d, searcher, words[i])))
+                count++;
+        return count;
+    }
+
+    /* Hash lookups gain nothing from ordering words */
+    if (options == PICODICT_FIND_EXACT && d->phash_slots) {
+        STAT_ADD(d, lookups, n);
+        for (size_t i = 0; i < n; ++i) {
+            _pd_interval found = _pd_phash_search(d, searcher, words[i]);
+            if (found.lower != found.upper) {
+                results[i] = _make_pd_result(d, found);
+                count++;
+            }
+        }
+        return count;
+    }
+
+    _pd_batch_item *items = malloc(n * sizeof(_pd_batch_item));
+    const char **sorted = malloc(n * sizeof(const char *));
+    _pd_interval *found = malloc(n * sizeof(_pd_interval));
+    if (!items || !sorted || !found)
+        goto out;
+
+    /*
+     * Words are ordered with the full-word comparison function: entries
+     * starting with prefix come in the same order as prefixes themselves.
+     */
+    _pd_cmp order = _pd_get_searcher(d, PICODICT_FIND_EXACT)->cmp;
+    size_t filtered = 0;
+    for (size_t i = 0; i < n; ++i) {
+        /* Words rejected by Bloom filter are not searched at all */
+        if (options == PICODICT_FIND_EXACT && d->bloom
+            && !_pd_bloom_check(d, words[i])) {
+            filtered++;
+            continue;
+        }
+        items[i - filtered].word = words[i];
+        items[i - filtered].pos = i;
+        items[i - filtered].cmp = order;
+    }
+    STAT_ADD(d, lookups, n);
+    STAT_ADD(d, filtered, filtered);
+    n -= filtered;
+
+    qsort(items, n, sizeof(_pd_batch_item), _pd_batch_item_cmp);
+
+    for (size_t i = 0; i < n; ++i)
+        sorted[i] = items[i].word;
+
+    if (d->trie)
+        for (size_t i = 0; i < n; ++i)
+            found[i] = _pd_trie_search(d, searcher, sorted[i], options);
+    else if (d->keys)
+        _pd_search_keys(d, sorted, n, options, found);
+    else
+        searcher->search_sorted(d, sorted, n, found);
+
+    for (size_t i = 0; i < n; ++i)
+        if (found[i].lower != found[i].upper) {
+            results[items[i].pos] = _make_pd_result(d, found[i]);
+            count++;
+        }
+
+out:
+    free(found);
+    free(sorted);
+    free(items);
+    return count;
+}
+
+/*
+ * Reads article of index line, stores its length to length. Articles of
+ * compressed dictionaries fitting into single chunk are not copied: the chunk
+ * is pinned in cache and stored to chunk. Otherwise article is copied to
+ * allocated memory, and allocated is set.
+ */
+static char *
+_pd_article_load(pd_dictionary *d, const char *entry, const char *end,
+                 size_t *length, bool *allocated, _pd_chunk **chunk)
+{
+    pd_index_line line = _parse_index_line(entry, end);
+    *length = line.article_length;
+    *allocated = false;
+    *chunk = NULL;
+
+    if (!d->compressed)
+        return (char *)d->data + line.article_offset;
+
+    int chunk_id = line.article_offset / d->chunk_length;
+    size_t offset_in_chunk = line.article_offset % d->chunk_length;
+
+    if (offset_in_chunk + line.article_length <= d->chunk_length) {
+        *chunk = _pd_chunk_pin(d, chunk_id);
+        return *chunk ? (*chunk)->data + offset_in_chunk : NULL;
+    }
+
+    *allocated = true;
+    return _read_compressed(d, line.article_offset, line.article_length);
+}
+
+static void
+_pd_article_release(pd_dictionary *d, char *article, bool allocated,
+                    _pd_chunk *chunk)
+{
+    if (allocated)
+        free(article);
+    if (chunk)
+        _pd_chunk_unpin(d, chunk);
+}
+
+const char *
+pd_result_article(pd_result *r, size_t *size)
+{
+    if (!r->article)
+        r->article = _pd_article_load(r->dict, r->result.lower,
+                                      r->result.upper, &r->article_length,
+                                      &r->article_allocated,
+                                      &r->article_chunk);
+
+    *size = r->article_length;
+    return r->article;
+}
+
+typedef struct {
+    pd_result *result;
+    size_t offset;
+} _pd_article_ref;
+
+static int
+_pd_article_ref_cmp(const void *lhs, const void *rhs)
+{
+    const _pd_article_ref *l = lhs;
+    const _pd_article_ref *r = rhs;
+    return l->offset < r->offset ? -1 : l->offset > r->offset;
+}
+
+void
+pd_result_article_batch(pd_result **results, size_t n)
+{
+    _pd_article_ref *refs = malloc(n * sizeof(_pd_article_ref));
+    if (!refs)
+        return;
+
+    size_t count = 0;
+    for (size_t i = 0; i < n; ++i) {
+        pd_result *r = results[i];
+        if (!r || r->article)
+            continue;
+        pd_index_line line = _parse_index_line(r->result.lower,
+                                               r->result.upper);
+        refs[count].result = r;
+        refs[count].offset = line.article_offset;
+        count++;
+    }
+
+    /*
+     * Articles are read in the order of their placement in data file, so
+     * every chunk is decompressed once and used while it is still cached.
+     */
+    qsort(refs, count, sizeof(_pd_article_ref), _pd_article_ref_cmp);
+
+    for (size_t i = 0; i < count; ++i) {
+        size_t size;
+        pd_result_article(refs[i].result, &size);
+    }
+
+    free(refs);
+}
+
+const char *
+pd_result_headword(pd_result *r, size_t *length)
+{
+    const char *tab = memchr(r->result.lower, '\t',
+                             r->result.upper - r->result.lower);
+    *length = tab ? tab - r->result.lower : 0;
+    return r->result.lower;
+}
+
+pd_result *
+pd_result_next(pd_result *r)
+{
+    if (r->matches) {
+        if (r->match + 1 == r->matches->count)
+            return NULL;
+        return _make_pd_match(r->dict, r->matches, r->match + 1);
+    }
+
+    _pd_interval i = _advance_to_next_entry(r->result);
+    if (i.lower == i.upper)
+        return NULL;
+
+    return _make_pd_result(r->dict, i);
+}
+
+void
+pd_result_free(pd_result *r)
+{
+    _pd_article_release(r->dict, r->article, r->article_allocated,
+                        r->article_chunk);
+    _pd_match_list_unref(r->matches);
+    free(r);
+}
+
+/*
+ * Returns number of line starting at given position of index, or number of
+ * lines for the end of index. Line offset table should be available.
+ */
+static size_t
+_pd_line_number(pd_dictionary *d, const char *line)
+{
+    size_t offset = line - (const char *)d->index;
+    size_t lo = 0;
+    size_t hi = d->line_count;
+    while (lo < hi) {
+        size_t middle = lo + (hi - lo)/2;
+        if (d->lines[middle] < offset)
+            lo = middle + 1;
+        else
+            hi = middle;
     }
-    if (flags & GZIP_FHCRC)
-        data_offset += 2;
+    return lo;
+}
 
-    if (data_offset >= size)
-        return DZ_ERROR;
+static size_t
+_pd_count_lines(pd_dictionary *d, const char *start, const char *end)
+{
+    if (d->lines)
+        return _pd_line_number(d, end) - _pd_line_number(d, start);
 
-    /* chunks extra data */
+    size_t count = 0;
+    for (const char *c = start; (c = memchr(c, '\n', end - c)); c++)
+        count++;
+    return count;
+}
 
-    dict->chunk_offsets = malloc((dict->chunk_count+1) * sizeof(int));
-    for (int i = 0; i < dict->chunk_count; ++i) {
-        unsigned chunk_len = le16toh(*(unsigned short *)(file + 22 + 2*i));
-        dict->chunk_offsets[i] = data_offset;
-        data_offset += chunk_len;
+/*
+ * Returns start of n-th line after start, or NULL if there are less than n
+ * lines before end.
+ */
+static const char *
+_pd_skip_lines(pd_dictionary *d, const char *start, const char *end,
+               size_t n)
+{
+    if (d->lines) {
+        size_t line = _pd_line_number(d, start) + n;
+        if (line > _pd_line_number(d, end))
+            return NULL;
+        return _line_start(d, line);
     }
-    dict->chunk_offsets[dict->chunk_count] = data_offset;
 
-    if (data_offset >= size + 1) { /* data_offset might be == size */
-        free(dict->chunk_offsets);
-        return DZ_ERROR;
+    for (; n; --n) {
+        if (start == end)
+            return NULL;
+        start = _nextline(start);
     }
+    return start;
+}
 
-    return DZ_OK;
+size_t
+pd_result_count(pd_result *r)
+{
+    if (r->matches)
+        return r->matches->count - r->match;
+    return _pd_count_lines(r->dict, r->result.lower, r->result.upper);
 }
 
-/*
- * Returns NULL and sets errno on error
- */
-static void *
-_mmap_ro(const char *filename, size_t *size)
+int
+pd_result_seek(pd_result *r, size_t n)
 {
-    int fd = open(filename, O_RDONLY);
-    if (fd == -1)
-        return NULL;
+    const char *entry;
+    const char *upper = r->result.upper;
+    if (r->matches) {
+        if (n >= r->matches->count - r->match)
+            return 0;
+        entry = r->matches->lines[r->match + n];
+        upper = _nextline(entry);
+    } else {
+        entry = _pd_skip_lines(r->dict, r->result.lower, r->result.upper, n);
+        if (!entry || entry == r->result.upper)
+            return 0;
+    }
 
-    struct stat st;
-    if (fstat(fd, &st) == -1)
-        goto err;
+    if (n) {
+        _pd_article_release(r->dict, r->article, r->article_allocated,
+                            r->article_chunk);
+        r->article = NULL;
+        r->article_allocated = false;
+        r->article_chunk = NULL;
+        r->result.lower = entry;
+        r->result.upper = upper;
+        r->match += r->matches ? n : 0;
+    }
+    return 1;
+}
 
-    void *ptr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
-    if (ptr == MAP_FAILED)
-        goto err;
+/* -- Iterator -- */
 
-    close(fd);
-    *size = st.st_size;
-    return ptr;
+#define ITER_COUNT_UNKNOWN ((size_t)-1)
 
-err:
-    close(fd);
-    return NULL;
+static void
+_pd_iter_release(pd_iter *it)
+{
+    _pd_article_release(it->dict, (char *)it->article, it->article_allocated,
+                        it->article_chunk);
+    it->article = NULL;
+    it->article_allocated = false;
+    it->article_chunk = NULL;
 }
 
-pd_dictionary *
-pd_open(const char *index_file, const char *data_file, pd_sort_mode mode)
+int
+pd_iter_find(pd_iter *it, pd_dictionary *d, const char *text,
+             pd_find_mode options)
 {
-    pd_dictionary *dict = calloc(1, sizeof(pd_dictionary));
-    if (!dict)
-        return NULL;
-
-    dict->mode = mode;
+    memset(it, 0, sizeof(*it));
+    it->dict = d;
 
-    dict->index = _mmap_ro(index_file, &dict->index_size);
-    if (!dict->index)
-        goto err;
+    const _pd_searcher *searcher = _pd_get_searcher(d, options);
+    if (!searcher || options == PICODICT_FIND_FUZZY)
+        return 0;
 
-    dict->data = _mmap_ro(data_file, &dict->data_size);
-    if (!dict->data)
-        goto err2;
+    _pd_interval i = _pd_find(d, searcher, text, options);
+    if (i.lower == i.upper)
+        return 0;
 
-    dz_parse_result res = _parse_dz_header(dict, dict->data, dict->data_size);
-    if (res == DZ_ERROR)
-        goto err3;
+    it->start = it->entry = i.lower;
+    it->end = i.upper;
+    it->count = ITER_COUNT_UNKNOWN;
 
-    if (res == DZ_OK) {
-        dict->z.zalloc = Z_NULL;
-        dict->z.zfree = Z_NULL;
-        dict->z.opaque = Z_NULL;
-        dict->z.next_in = dict->data;
-        dict->z.avail_in = dict->data_size;
-        int ret = inflateInit2(&dict->z, -15);
-        if (ret != Z_OK)
-            goto err3;
-        dict->compressed = true;
+    _pd_prefetch(d, i.lower, i.upper);
 
-        for(int i = 0; i < CHUNK_CACHE_SIZE; ++i)
-            dict->chunk_cache.id[i] = -1;
+    /* With line offset table seeking and counting need no index scans */
+    if (d->lines) {
+        it->start_line = _pd_line_number(d, i.lower);
+        it->count = _pd_line_number(d, i.upper) - it->start_line;
     }
+    return 1;
+}
 
-    return dict;
+const char *
+pd_iter_article(pd_iter *it, size_t *size)
+{
+    if (!it->article) {
+        bool allocated;
+        _pd_chunk *chunk;
+        it->article = _pd_article_load(it->dict, it->entry, it->end,
+                                       &it->article_length, &allocated,
+                                       &chunk);
+        it->article_allocated = allocated;
+        it->article_chunk = chunk;
+    }
 
-err3:
-    free(dict->chunk_offsets);
-    munmap(dict->data, dict->data_size);
-err2:
-    munmap(dict->index, dict->index_size);
-err:
-    free(dict);
-    return NULL;
+    *size = it->article_length;
+    return it->article;
 }
 
-static void
-_pd_chunk_cache_free(_pd_chunk_cache* cache)
+const char *
+pd_iter_headword(pd_iter *it, size_t *length)
 {
-    for (int i = 0; i < CHUNK_CACHE_SIZE; ++i)
-        if (cache->id[i] != -1)
-            free(cache->data[i]);
+    const char *tab = memchr(it->entry, '\t', it->end - it->entry);
+    *length = tab ? tab - it->entry : 0;
+    return it->entry;
 }
 
-void
-pd_close(pd_dictionary *dict)
+int
+pd_iter_next(pd_iter *it)
 {
-    munmap(dict->index, dict->index_size);
-    munmap(dict->data, dict->data_size);
+    if (!it->entry)
+        return 0;
 
-    if (dict->compressed) {
-        free(dict->chunk_offsets);
-        inflateEnd(&dict->z);
-        _pd_chunk_cache_free(&dict->chunk_cache);
-    }
+    const char *next = _nextline(it->entry);
+    if (next >= it->end)
+        return 0;
 
-    free(dict);
+    _pd_iter_release(it);
+    it->entry = next;
+    it->position++;
+    return 1;
 }
 
-/* -- Resultset -- */
-
-static bool
-_is_base64_sym(int c)
+size_t
+pd_iter_count(pd_iter *it)
 {
-    return ('A' <= c && c <= 'Z')
-        || ('a' <= c && c <= 'z')
-        || ('0' <= c && c <= '9')
-        || c == '+' || c == '/';
+    if (it->count == ITER_COUNT_UNKNOWN)
+        it->count = _pd_count_lines(it->dict, it->start, it->end);
+    return it->count;
 }
 
-static unsigned
-_base64_decode(const char *str)
+int
+pd_iter_seek(pd_iter *it, size_t n)
 {
-    unsigned n = 0;
-    for (char c = *str++; _is_base64_sym(c); c = *str++) {
-        n <<= 6;
-        if ('A' <= c && c <= 'Z') n += c - 'A';
-        else if ('a' <= c && c <= 'z') n += c - 'a' + 26;
-        else if ('0' <= c && c <= '9') n += c - '0' + 52;
-        else if (c == '+') n += 62;
-        else if (c == '/') n += 63;
+    if (!it->entry)
+        return 0;
+    if (n == it->position)
+        return 1;
+
+    const char *entry;
+    if (it->dict->lines) {
+        if (n >= it->count)
+            return 0;
+        entry = _line_start(it->dict, it->start_line + n);
+    } else if (n > it->position) {
+        entry = _pd_skip_lines(it->dict, it->entry, it->end, n - it->position);
+    } else {
+        entry = _pd_skip_lines(it->dict, it->start, it->end, n);
     }
-    return n;
-}
-
-typedef struct {
-    const char *name;
-    const char *endname;
-    size_t article_offset;
-    size_t article_length;
-
-    const char *nextline;
-} pd_index_line;
-
-static pd_index_line
-_parse_index_line(const char *line, const char *end)
-{
-    pd_index_line ret = {};
-    /* <name> \t <pos> \t <len> \n
-     * ^      ^  ^     ^  ^     ^
-     * |      |  |     |  |     |
-     * |      |  pos   |  len   endlen
-     * |      |        |
-     * name   endname  endpos
-     *
-     * <pos> and <len> are base64-encoded strings
-     */
-    const char *name = line;
-    const char *endname = line;
-    while (endname < end && *endname != '\t') endname++;
-    if (endname == end || endname == name)
-        return ret;
-    const char *pos = endname + 1;
-    const char *endpos = pos;
-    while (endpos < end && _is_base64_sym(*endpos)) endpos++;
-    if (endpos == end || endpos == pos || *endpos != '\t')
-        return ret;
-    const char *len = endpos + 1;
-    const char *endlen = len;
-    while (endlen < end && _is_base64_sym(*endlen)) endlen++;
-    if (endlen == end || endlen == len || *endlen != '\n')
-        return ret;
+    if (!entry || entry == it->end)
+        return 0;
 
-    ret.name = line;
-    ret.endname = endname;
-    ret.article_offset = _base64_decode(pos);
-    ret.article_length = _base64_decode(len);
-    ret.nextline = endlen + 1;
-    return ret;
+    _pd_iter_release(it);
+    it->entry = entry;
+    it->position = n;
+    return 1;
 }
 
-static bool
-_uncompress_chunk(pd_dictionary *dict, int chunk_id, char *out)
+void
+pd_iter_done(pd_iter *it)
 {
-    dict->z.next_in = dict->data + dict->chunk_offsets[chunk_id];
-    dict->z.avail_in =
-        dict->chunk_offsets[chunk_id + 1] - dict->chunk_offsets[chunk_id];
-    dict->z.next_out = (unsigned char *)out;
-    dict->z.avail_out = dict->chunk_length;
-
-    int ret = inflate(&dict->z, Z_PARTIAL_FLUSH);
+    _pd_iter_release(it);
+}
 
-    if (ret == Z_OK || ret == Z_STREAM_END)
-        return true;
+/* -- Asynchronous lookups -- */
 
-    return false;
-}
+typedef enum {
+    REQUEST_PENDING,
+    REQUEST_RUNNING,
+    REQUEST_DONE,
+    REQUEST_CANCELLED,
+} _pd_request_state;
 
 /*
- * Result is stored in cache in pd_dictionary and may be overwritten by
- * subsequent call to _read_chunk.
+ * Request is referenced by caller and by the task in pool. State changes
+ * from PENDING to RUNNING and then to DONE, cancellation moves it from either
+ * of the first two to CANCELLED.
  */
-static char *
-_read_chunk(pd_dictionary *dict, int chunk_id)
-{
-    _pd_chunk_cache *cache = &dict->chunk_cache;
+struct pd_request {
+    int refcount;
+    int state;
 
-    for (int i = 0; i < CHUNK_CACHE_SIZE; ++i)
-        if (cache->id[i] == chunk_id)
-            return cache->data[i];
+    pd_dictionary *dict;
+    pd_request_callback callback;
+    void *data;
 
-    int next = (cache->next_id++) % CHUNK_CACHE_SIZE;
+    /* pd_find_async() */
+    char *text;
+    pd_find_mode options;
+    pd_result *result;
 
-    if (cache->id[next] == -1)
-        cache->data[next] = malloc(dict->chunk_length);
+    /* pd_article_async(): a copy of result passed, article is owned by it */
+    pd_result *source;
+    const char *article;
+    size_t article_size;
+};
 
-    if (_uncompress_chunk(dict, chunk_id, cache->data[next])) {
-        cache->id[next] = chunk_id;
-        return cache->data[next];
-    } else {
-        free(cache->data[next]);
-        cache->data[next] = NULL;
-        cache->id[next] = -1;
-        return NULL;
-    }
+static void
+_pd_request_unref(pd_request *req)
+{
+    if (__sync_sub_and_fetch(&req->refcount, 1))
+        return;
+
+    if (req->result)
+        pd_result_free(req->result);
+    if (req->source)
+        pd_result_free(req->source);
+    free(req->text);
+    free(req);
 }
 
-static int
-_min(size_t a, size_t b)
+static bool
+_pd_request_switch(pd_request *req, int from, int to)
 {
-    return a < b ? a : b;
+    return __atomic_compare_exchange_n(&req->state, &from, to, false,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
 }
 
-static char *
-_read_compressed(pd_dictionary *dict, size_t offset, size_t size)
+static void
+_pd_request_run(void *arg)
 {
-    char *data = malloc(sizeof(char) * size);
-    if (!data)
-        return NULL;
-    size_t data_offset = 0;
+    pd_request *req = arg;
 
-    while (size) {
-        int chunk_id = offset / dict->chunk_length;
-        size_t offset_in_chunk = offset % dict->chunk_length;
-        char *chunk = _read_chunk(dict, chunk_id);
-        if (!chunk) {
-            free(data);
-            return NULL;
-        }
+    if (_pd_request_switch(req, REQUEST_PENDING, REQUEST_RUNNING)) {
+        if (req->text)
+            req->result = pd_find(req->dict, req->text, req->options);
+        else
+            req->article = pd_result_article(req->source, &req->article_size);
 
-        size_t to_copy = _min(dict->chunk_length - offset_in_chunk, size);
-        memcpy(data + data_offset, chunk + offset_in_chunk, to_copy);
-        offset += to_copy;
-        size -= to_copy;
-        data_offset += to_copy;
+        if (_pd_request_switch(req, REQUEST_RUNNING, REQUEST_DONE)
+            && req->callback)
+            req->callback(req, req->data);
     }
 
-    return data;
-}
-
-static pd_result *
-_make_pd_result(pd_dictionary *d, _pd_interval i)
-{
-    pd_result *res = calloc(1, sizeof(pd_result));
-    res->dict = d;
-    res->result = i;
-    return res;
+    _pd_request_unref(req);
 }
 
-static _pd_interval
-_advance_to_next_entry(_pd_interval i)
+static pd_request *
+_pd_request_new(pd_dictionary *d, pd_request_callback callback, void *data)
 {
-    _pd_interval ret = {
-        .lower = _nextline(i.lower),
-        .upper = i.upper
-    };
-    return ret;
+    pd_request *req = calloc(1, sizeof(pd_request));
+    if (!req)
+        return NULL;
+    req->refcount = 1;
+    req->state = REQUEST_PENDING;
+    req->dict = d;
+    req->callback = callback;
+    req->data = data;
+    return req;
 }
 
-char *
-pd_name(pd_dictionary *d)
+static void
+_pd_request_submit(pd_request *req)
 {
-    _pd_interval i = _find_entry((_pd_cmp)_pd_strcasecmp, "00-database-short",
-                                 d->index, d->index + d->index_size);
-    if (i.lower == i.upper) {
-        i = _find_entry((_pd_cmp)_pd_strcasecmp, "00databaseshort",
-                        d->index, d->index + d->index_size);
-        if (i.lower == i.upper) {
-            return NULL;
+    pd_dictionary *d = req->dict;
+
+    _pd_pool *pool = __atomic_load_n(&d->async_pool, __ATOMIC_ACQUIRE);
+    if (!pool) {
+        _pd_pool *new_pool = _pd_pool_new(ASYNC_THREADS);
+        if (new_pool) {
+            if (__sync_bool_compare_and_swap(&d->async_pool, NULL, new_pool))
+                pool = new_pool;
+            else
+                _pd_pool_free(new_pool);
         }
+        pool = __atomic_load_n(&d->async_pool, __ATOMIC_ACQUIRE);
     }
 
-    pd_result *res = _make_pd_result(d, i);
-
-    size_t size;
-    const char *article = pd_result_article(res, &size);
-
-    char *str;
-    if (!strncmp(article, "00-database-short\n", 18)
-        || !strncmp(article, "00databaseshort\n", 16)) {
-        /* Skip first line and indentation */
-        const char *nl = _nextline(article);
-        while (isspace(*nl)) nl++;
-        const char *endl = strchr(nl, '\n');
-
-        str = malloc(endl - nl + 1);
-        strncpy(str, nl, endl - nl);
-        str[endl - nl] = '\0';
-    } else {
-        /* Whole article is description */
-        str = malloc(size + 1);
-        strncpy(str, article, size);
-        str[size] = '\0';
-    }
-
-    pd_result_free(res);
-
-    return str;
+    /* Reference of task */
+    __sync_add_and_fetch(&req->refcount, 1);
+    if (!pool || !_pd_pool_submit(pool, _pd_request_run, req))
+        _pd_request_run(req);
 }
 
-
-pd_result *
-pd_find(pd_dictionary *d, const char *text, pd_find_mode options)
+pd_request *
+pd_find_async(pd_dictionary *d, const char *text, pd_find_mode options,
+              pd_request_callback callback, void *data)
 {
-    _pd_cmp cmp;
-
-    if (d->mode == PICODICT_SORT_ALPHABET) {
-        if (options == PICODICT_FIND_EXACT)
-            cmp = (_pd_cmp)_pd_strcasecmp;
-        else
-            cmp = (_pd_cmp)_pd_strprefixcasecmp;
-    } else if (d->mode == PICODICT_SORT_SKIPUNALPHA) {
-        if (options == PICODICT_FIND_EXACT)
-            cmp = (_pd_cmp)_pd_strdictcmp;
-        else
-            cmp = (_pd_cmp)_pd_strprefixdictcmp;
-    } else {
+    pd_request *req = _pd_request_new(d, callback, data);
+    if (!req)
         return NULL;
-    }
 
-    _pd_interval i = _find_entry(cmp, text, d->index, d->index + d->index_size);
-    if (i.lower == i.upper)
+    req->options = options;
+    req->text = strdup(text);
+    if (!req->text) {
+        _pd_request_unref(req);
         return NULL;
+    }
 
-    return _make_pd_result(d, i);
+    _pd_request_submit(req);
+    return req;
 }
 
-const char *
-pd_result_article(pd_result *r, size_t *size)
+pd_request *
+pd_article_async(pd_result *r, pd_request_callback callback, void *data)
 {
-    if (!r->article) {
-        pd_index_line line = _parse_index_line(r->result.lower, r->result.upper);
-        r->article_length = line.article_length;
+    pd_request *req = _pd_request_new(r->dict, callback, data);
+    if (!req)
+        return NULL;
 
-        if (r->dict->compressed) {
-            r->article = _read_compressed(r->dict, line.article_offset,
-                                          line.article_length);
-            r->article_allocated = true;
-        } else {
-            r->article = r->dict->data + line.article_offset;
-        }
+    req->source = _make_pd_result(r->dict, r->result);
+    if (!req->source) {
+        _pd_request_unref(req);
+        return NULL;
     }
 
-    *size = r->article_length;
-    return r->article;
+    _pd_request_submit(req);
+    return req;
+}
+
+int
+pd_request_done(pd_request *req)
+{
+    return __atomic_load_n(&req->state, __ATOMIC_ACQUIRE) == REQUEST_DONE;
 }
 
 pd_result *
-pd_result_next(pd_result *r)
+pd_request_result(pd_request *req)
 {
-    _pd_interval i = _advance_to_next_entry(r->result);
-    if (i.lower == i.upper)
+    if (!pd_request_done(req))
         return NULL;
+    return __atomic_exchange_n(&req->result, NULL, __ATOMIC_ACQ_REL);
+}
 
-    return _make_pd_result(r->dict, i);
+const char *
+pd_request_article(pd_request *req, size_t *size)
+{
+    if (!pd_request_done(req) || !req->article)
+        return NULL;
+    *size = req->article_size;
+    return req->article;
+}
+
+int
+pd_request_cancel(pd_request *req)
+{
+    return _pd_request_switch(req, REQUEST_PENDING, REQUEST_CANCELLED)
+        || _pd_request_switch(req, REQUEST_RUNNING, REQUEST_CANCELLED)
+        || __atomic_load_n(&req->state, __ATOMIC_ACQUIRE) == REQUEST_CANCELLED;
 }
 
 void
-pd_result_free(pd_result *r)
+pd_request_free(pd_request *req)
 {
-    if (r->article_allocated)
-        free(r->article);
-    free(r);
+    pd_request_cancel(req);
+    _pd_request_unref(req);
+}
+
+/* -- Statistics -- */
+
+void
+pd_get_stats(pd_dictionary *d, pd_stats *stats)
+{
+#define STAT_GET(counter) \
+    stats->counter = __atomic_load_n(&d->stats.counter, __ATOMIC_RELAXED)
+    STAT_GET(lookups);
+    STAT_GET(probes);
+    STAT_GET(comparisons);
+    STAT_GET(cache_hits);
+    STAT_GET(cache_misses);
+    STAT_GET(cache_evictions);
+    STAT_GET(bytes_inflated);
+    STAT_GET(inflate_usec);
+    STAT_GET(filtered);
+    STAT_GET(store_hits);
+#undef STAT_GET
+}
+
+void
+pd_reset_stats(pd_dictionary *d)
+{
+#define STAT_RESET(counter) \
+    __atomic_store_n(&d->stats.counter, 0, __ATOMIC_RELAXED)
+    STAT_RESET(lookups);
+    STAT_RESET(probes);
+    STAT_RESET(comparisons);
+    STAT_RESET(cache_hits);
+    STAT_RESET(cache_misses);
+    STAT_RESET(cache_evictions);
+    STAT_RESET(bytes_inflated);
+    STAT_RESET(inflate_usec);
+    STAT_RESET(filtered);
+    STAT_RESET(store_hits);
+#undef STAT_RESET
 }
 
 /* -- Validation -- */
 
-#define SORT_COUNT 2
+/*
+ * Validation may be split between several threads: data chunks are
+ * decompressed independently, and index is split into stripes at line
+ * boundaries, each stripe checked separately.
+ */
 
-static pd_sort_mode
-_pd_validate_index(void *index, size_t index_size, size_t data_size)
+static unsigned
+_pd_threads(unsigned threads)
 {
+    if (threads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? cpus : 1;
+    }
+    return threads;
+}
+
+/*
+ * Runs fn for each of threads arguments, stored in args array with stride of
+ * size bytes, in parallel. The first one is run in calling thread. If thread
+ * can't be created, its work is done by calling thread too.
+ */
+static void
+_pd_parallel(unsigned threads, void *(*fn)(void *), void *args, size_t size)
+{
+    pthread_t *tids = calloc(threads, sizeof(pthread_t));
+    bool *started = calloc(threads, sizeof(bool));
+    if (!tids || !started)
+        threads = 1;
+
+    for (unsigned i = 1; i < threads; ++i)
+        started[i] =
+            !pthread_create(&tids[i], NULL, fn, (char *)args + i * size);
+
+    (*fn)(args);
+
+    for (unsigned i = 1; i < threads; ++i) {
+        if (started[i])
+            pthread_join(tids[i], NULL);
+        else
+            (*fn)((char *)args + i * size);
+    }
+
+    free(started);
+    free(tids);
+}
+
+typedef struct {
+    const char *index;
+    size_t index_size;
+    size_t data_size;
+
+    /* Lines starting in [start, end) are checked */
+    const char *start;
+    const char *end;
+
+    bool malformed;
+    bool non_ascii;
     bool sort_valid[SORT_COUNT];
-    memset(sort_valid, true, sizeof(sort_valid));
+} _pd_index_stripe;
+
+static void *
+_pd_validate_stripe(void *arg)
+{
+    _pd_index_stripe *st = arg;
+    const char *index_end = st->index + st->index_size;
+
+    memset(st->sort_valid, true, sizeof(st->sort_valid));
 
     _pd_cmp sort[SORT_COUNT] = { /* Those should match pd_sort_mode */
         (_pd_cmp)_pd_strcasecmp,
         (_pd_cmp)_pd_strdictcmp,
+        (_pd_cmp)_pd_strcasecmp_utf8,
+        (_pd_cmp)_pd_strdictcmp_utf8,
     };
 
+    /* Stripe is checked against the last line of previous one */
     const char *prev_name = NULL;
+    if (st->start > st->index) {
+        prev_name = st->start - 1;
+        while (prev_name > st->index && prev_name[-1] != '\n') prev_name--;
+    }
 
-    for (const char *cur = index;;) {
-        pd_index_line line = _parse_index_line(cur, index + index_size);
+    for (const char *cur = st->start; cur < st->end;) {
+        pd_index_line line = _parse_index_line(cur, index_end);
         /* Check that line is parsed succesfully */
-        if (line.name == NULL)
-            return PICODICT_DATA_MALFORMED;
+        if (line.name == NULL) {
+            st->malformed = true;
+            break;
+        }
         /* Ignore special headwords */
         if (!strncmp("00database", line.name, 10)
             || !strncmp("00-database-", line.name, 12)) {
@@ -910,40 +4865,162 @@ _pd_validate_index(void *index, size_t index_size, size_t data_size)
             continue;
         }
         /* Check bounds of article */
-        if (line.article_offset + line.article_length > data_size)
-            return PICODICT_DATA_MALFORMED;
+        if (line.article_offset + line.article_length > st->data_size) {
+            st->malformed = true;
+            break;
+        }
+        for (const char *c = line.name; c < line.endname && !st->non_ascii; ++c)
+            if ((unsigned char)*c >= 0x80)
+                st->non_ascii = true;
         /* Check sorting */
         if (prev_name)
             for (int i = 0; i < SORT_COUNT; ++i)
-                if (sort_valid[i]) {
+                if (st->sort_valid[i]) {
                     if ((*sort[i])(prev_name, line.name) > 0)
-                        sort_valid[i] = false;
+                        st->sort_valid[i] = false;
                 }
-        /* Stop if finished */
-        if (line.nextline == index + index_size)
-            break;
         cur = line.nextline;
         prev_name = line.name;
     }
 
+    return NULL;
+}
+
+static pd_sort_mode
+_pd_validate_index(void *index, size_t index_size, size_t data_size,
+                   unsigned threads)
+{
+    if (index_size == 0)
+        return PICODICT_DATA_MALFORMED;
+
+    /* Don't bother splitting small indices */
+    if (threads > index_size / 65536 + 1)
+        threads = index_size / 65536 + 1;
+
+    _pd_index_stripe *stripes = calloc(threads, sizeof(_pd_index_stripe));
+    if (!stripes)
+        return PICODICT_DATA_MALFORMED;
+
+    const char *index_end = (const char *)index + index_size;
+    const char *start = index;
+    for (unsigned i = 0; i < threads; ++i) {
+        const char *end = index_end;
+        if (i < threads - 1) {
+            end = (const char *)index + index_size / threads * (i + 1);
+            if (end < start)
+                end = start;
+            end = memchr(end, '\n', index_end - end);
+            end = end ? end + 1 : index_end;
+        }
+
+        stripes[i].index = index;
+        stripes[i].index_size = index_size;
+        stripes[i].data_size = data_size;
+        stripes[i].start = start;
+        stripes[i].end = end;
+        start = end;
+    }
+
+    _pd_parallel(threads, _pd_validate_stripe, stripes,
+                 sizeof(_pd_index_stripe));
+
+    bool sort_valid[SORT_COUNT];
+    memset(sort_valid, true, sizeof(sort_valid));
+    bool non_ascii = false;
+
+    pd_sort_mode ret = PICODICT_SORT_UNKNOWN;
+    for (unsigned i = 0; i < threads; ++i) {
+        if (stripes[i].malformed) {
+            ret = PICODICT_DATA_MALFORMED;
+            goto out;
+        }
+        for (int j = 0; j < SORT_COUNT; ++j)
+            sort_valid[j] = sort_valid[j] && stripes[i].sort_valid[j];
+        non_ascii = non_ascii || stripes[i].non_ascii;
+    }
+
+    /*
+     * UTF-8 modes make difference only if there are non-ASCII headwords,
+     * otherwise faster ASCII ones are preferred.
+     */
+    static const pd_sort_mode ascii_order[SORT_COUNT] = {
+        PICODICT_SORT_ALPHABET, PICODICT_SORT_SKIPUNALPHA,
+        PICODICT_SORT_ALPHABET_UTF8, PICODICT_SORT_SKIPUNALPHA_UTF8,
+    };
+    static const pd_sort_mode utf8_order[SORT_COUNT] = {
+        PICODICT_SORT_ALPHABET_UTF8, PICODICT_SORT_SKIPUNALPHA_UTF8,
+        PICODICT_SORT_ALPHABET, PICODICT_SORT_SKIPUNALPHA,
+    };
+    const pd_sort_mode *order = non_ascii ? utf8_order : ascii_order;
+
     for (int i = 0; i < SORT_COUNT; ++i)
-        if (sort_valid[i])
-            return (pd_sort_mode)i;
-    return PICODICT_SORT_UNKNOWN;
+        if (sort_valid[order[i]]) {
+            ret = order[i];
+            break;
+        }
+
+out:
+    free(stripes);
+    return ret;
+}
+
+typedef struct {
+    pd_dictionary *dict;
+    unsigned first;
+    unsigned step;
+    bool *failed;
+} _pd_data_stripe;
+
+static void *
+_pd_check_data_stripe(void *arg)
+{
+    _pd_data_stripe *st = arg;
+    pd_dictionary *d = st->dict;
+
+    char *tmp = malloc(d->chunk_length);
+    if (!tmp) {
+        __atomic_store_n(st->failed, true, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    for (size_t i = st->first; i < d->chunk_count; i += st->step) {
+        if (__atomic_load_n(st->failed, __ATOMIC_RELAXED))
+            break;
+        if (!_uncompress_chunk(d, i, tmp, NULL)) {
+            __atomic_store_n(st->failed, true, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+
+    free(tmp);
+    return NULL;
 }
 
 static pd_dict_stat
-_pd_check_data(pd_dictionary *d)
+_pd_check_data(pd_dictionary *d, unsigned threads)
 {
     if (d->compressed) {
-        char *tmp = malloc(d->chunk_length);
-        for (int i = 0; i < d->chunk_count; ++i) {
-            if (!_uncompress_chunk(d, i, tmp)) {
-                free(tmp);
-                return PICODICT_INVALID;
-            }
+        if (threads > d->chunk_count)
+            threads = d->chunk_count ? d->chunk_count : 1;
+
+        _pd_data_stripe *stripes = calloc(threads, sizeof(_pd_data_stripe));
+        if (!stripes)
+            return PICODICT_INVALID;
+
+        bool failed = false;
+        for (unsigned i = 0; i < threads; ++i) {
+            stripes[i].dict = d;
+            stripes[i].first = i;
+            stripes[i].step = threads;
+            stripes[i].failed = &failed;
         }
-        free(tmp);
+
+        _pd_parallel(threads, _pd_check_data_stripe, stripes,
+                     sizeof(_pd_data_stripe));
+        free(stripes);
+
+        if (failed)
+            return PICODICT_INVALID;
     }
 
     return PICODICT_OK;
@@ -958,18 +5035,13 @@ _pd_data_size(pd_dictionary *d)
         data_size = d->chunk_count * d->chunk_length;
         if (d->chunk_count > 0) {
             char *tmp = malloc(d->chunk_length);
-            int i = d->chunk_count - 1;
-            d->z.next_in = d->data + d->chunk_offsets[i];
-            d->z.avail_in = d->chunk_offsets[i+1] - d->chunk_offsets[i];
-            d->z.next_out = (unsigned char *)tmp;
-            d->z.avail_out = d->chunk_length;
-
-            int ret = inflate(&d->z, Z_PARTIAL_FLUSH);
+            size_t last_size;
+            bool ok = _uncompress_chunk(d, d->chunk_count - 1, tmp, &last_size);
             free(tmp);
-            if (ret != Z_OK && ret != Z_STREAM_END)
+            if (!ok)
                 return 0;
 
-            data_size -= d->z.avail_out;
+            data_size -= d->chunk_length - last_size;
         }
     } else
         data_size = d->data_size;
@@ -980,16 +5052,26 @@ _pd_data_size(pd_dictionary *d)
 pd_dict_stat
 pd_validate(const char *index_file, const char *data_file)
 {
+    return pd_validate_parallel(index_file, data_file, 1);
+}
+
+pd_dict_stat
+pd_validate_parallel(const char *index_file, const char *data_file,
+                     unsigned threads)
+{
+    threads = _pd_threads(threads);
+
     /* Open files && check .dict.dz header */
     pd_dictionary *d = pd_open(index_file, data_file, -1);
     if (!d)
         return PICODICT_INVALID;
 
-    if (_pd_check_data(d) != PICODICT_OK)
+    if (_pd_check_data(d, threads) != PICODICT_OK)
         goto err;
 
     /* Validate index (syntax, boundaries, sorting) */
-    if (_pd_validate_index(d->index, d->index_size, _pd_data_size(d)) < 0)
+    if (_pd_validate_index(d->index, d->index_size, _pd_data_size(d),
+                           threads) < 0)
         goto err;
 
     pd_close(d);
@@ -1003,14 +5085,405 @@ err:
 pd_sort_mode
 pd_get_sort_mode(const char *index_file, const char *data_file)
 {
+    return pd_get_sort_mode_parallel(index_file, data_file, 1);
+}
+
+pd_sort_mode
+pd_get_sort_mode_parallel(const char *index_file, const char *data_file,
+                          unsigned threads)
+{
+    threads = _pd_threads(threads);
+
     /* Open files && check .dict.dz header */
     pd_dictionary *d = pd_open(index_file, data_file, -1);
     if (!d)
         return PICODICT_DATA_MALFORMED;
 
-    pd_sort_mode ret =
-        _pd_validate_index(d->index, d->index_size, _pd_data_size(d));
+    pd_sort_mode ret = _pd_validate_index(d->index, d->index_size,
+                                          _pd_data_size(d), threads);
 
     pd_close(d);
     return ret;
 }
+
+/* -- Library -- */
+
+typedef struct {
+    pd_dictionary *dict;
+    int priority;
+} _pd_library_dict;
+
+struct pd_library {
+    _pd_pool *pool;
+    /* Sorted by priority, highest first */
+    _pd_library_dict *dicts;
+    size_t count;
+    size_t allocated;
+};
+
+typedef struct {
+    pd_dictionary *dict;
+    /* Single-article results, in order of index */
+    pd_result **articles;
+    size_t count;
+    bool done;
+} _pd_library_found;
+
+/*
+ * State of single pd_library_find() call, shared by threads searching for
+ * it. Dictionaries are taken for searching in order of priority.
+ */
+typedef struct {
+    pd_library *lib;
+    const char *text;
+    pd_find_mode options;
+    pd_library_order order;
+    size_t limit;
+
+    _pd_library_found *found;
+    size_t next;
+
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+    /* Tasks submitted to pool and not finished yet */
+    size_t tasks;
+    /* Dictionaries [0, done) are searched */
+    size_t done;
+    /* Articles found in them */
+    size_t done_articles;
+    bool stop;
+} _pd_library_query;
+
+struct pd_library_result {
+    size_t count;
+    _pd_library_found *found;
+    size_t found_count;
+    /* Articles and their dictionaries */
+    pd_result **articles;
+    pd_dictionary **dicts;
+};
+
+pd_library *
+pd_library_new(unsigned threads)
+{
+    pd_library *lib = calloc(1, sizeof(pd_library));
+    if (!lib)
+        return NULL;
+
+    /* Calling thread searches too */
+    lib->pool = _pd_pool_new(_pd_threads(threads) - 1);
+    if (!lib->pool) {
+        free(lib);
+        return NULL;
+    }
+    return lib;
+}
+
+int
+pd_library_add(pd_library *lib, pd_dictionary *d, int priority)
+{
+    if (lib->count == lib->allocated) {
+        size_t allocated = lib->allocated ? lib->allocated * 2 : 16;
+        _pd_library_dict *dicts =
+            realloc(lib->dicts, allocated * sizeof(_pd_library_dict));
+        if (!dicts)
+            return 0;
+        lib->dicts = dicts;
+        lib->allocated = allocated;
+    }
+
+    size_t i = lib->count;
+    while (i > 0 && lib->dicts[i - 1].priority < priority) {
+        lib->dicts[i] = lib->dicts[i - 1];
+        i--;
+    }
+    lib->dicts[i].dict = d;
+    lib->dicts[i].priority = priority;
+    lib->count++;
+    return 1;
+}
+
+void
+pd_library_free(pd_library *lib)
+{
+    _pd_pool_free(lib->pool);
+    free(lib->dicts);
+    free(lib);
+}
+
+/*
+ * Splits result of lookup into single-article results. At most limit of them
+ * are kept if limit is not 0.
+ */
+static bool
+_pd_library_collect(_pd_library_found *f, pd_result *r, size_t limit)
+{
+    size_t allocated = 0;
+    while (r) {
+        if (f->count == allocated) {
+            allocated = allocated ? allocated * 2 : 16;
+            if (limit && allocated > limit)
+                allocated = limit;
+            pd_result **articles =
+                realloc(f->articles, allocated * sizeof(pd_result *));
+            if (!articles) {
+                pd_result_free(r);
+                return false;
+            }
+            f->articles = articles;
+        }
+
+        f->articles[f->count++] = r;
+        r = !limit || f->count < limit ? pd_result_next(r) : NULL;
+    }
+    return true;
+}
+
+static void
+_pd_library_search(void *arg)
+{
+    _pd_library_query *q = arg;
+
+    for (;;) {
+        size_t i = __sync_fetch_and_add(&q->next, 1);
+        if (i >= q->lib->count || __atomic_load_n(&q->stop, __ATOMIC_RELAXED))
+            break;
+
+        _pd_library_found *f = &q->found[i];
+        pd_result *r = pd_find(f->dict, q->text, q->options);
+        if (r)
+            _pd_library_collect(f, r, q->limit);
+
+        pthread_mutex_lock(&q->lock);
+        f->done = true;
+        while (q->done < q->lib->count && q->found[q->done].done)
+            q->done_articles += q->found[q->done++].count;
+        /*
+         * All articles needed are found in dictionaries with higher priority
+         * than the ones not searched yet.
+         */
+        if (q->order == PICODICT_ORDER_PRIORITY && q->limit
+            && q->done_articles >= q->limit)
+            __atomic_store_n(&q->stop, true, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&q->lock);
+    }
+}
+
+static void
+_pd_library_task(void *arg)
+{
+    _pd_library_query *q = arg;
+    _pd_library_search(q);
+
+    pthread_mutex_lock(&q->lock);
+    if (--q->tasks == 0)
+        pthread_cond_signal(&q->finished);
+    pthread_mutex_unlock(&q->lock);
+}
+
+typedef struct {
+    pd_result *article;
+    pd_dictionary *dict;
+    /* Position in order of priority */
+    size_t pos;
+    /* Order of headwords, the same for all articles */
+    _pd_cmp cmp;
+} _pd_library_article;
+
+static int
+_pd_library_article_cmp(const void *lhs, const void *rhs)
+{
+    const _pd_library_article *l = lhs;
+    const _pd_library_article *r = rhs;
+
+    size_t l_len, r_len;
+    const char *l_word = pd_result_headword(l->article, &l_len);
+    const char *r_word = pd_result_headword(r->article, &r_len);
+    int c = l->cmp(l_word, r_word);
+    if (c)
+        return c;
+    return l->pos < r->pos ? -1 : l->pos > r->pos;
+}
+
+/*
+ * Returns order of headwords of dictionaries: their own one if all of them
+ * are sorted alike, case-insensitive UTF-8 order otherwise.
+ */
+static _pd_cmp
+_pd_library_cmp(pd_library_result *res)
+{
+    const _pd_searcher *searcher =
+        _pd_get_searcher(res->found[0].dict, PICODICT_FIND_EXACT);
+    for (size_t i = 1; searcher && i < res->found_count; ++i)
+        if (res->found[i].dict->mode != res->found[0].dict->mode)
+            searcher = NULL;
+
+    if (!searcher)
+        searcher = &_pd_searchers[PICODICT_SORT_ALPHABET_UTF8]
+                                 [PICODICT_FIND_EXACT];
+    return searcher->cmp;
+}
+
+/*
+ * Merges articles found in given order, frees the ones over limit.
+ */
+static bool
+_pd_library_merge(pd_library_result *res, size_t limit, pd_library_order order)
+{
+    size_t total = 0;
+    for (size_t i = 0; i < res->found_count; ++i)
+        total += res->found[i].count;
+
+    _pd_cmp cmp = _pd_library_cmp(res);
+
+    _pd_library_article *all = malloc(total * sizeof(_pd_library_article));
+    if (!all)
+        return false;
+
+    size_t n = 0;
+    for (size_t i = 0; i < res->found_count; ++i)
+        for (size_t j = 0; j < res->found[i].count; ++j) {
+            all[n].article = res->found[i].articles[j];
+            all[n].dict = res->found[i].dict;
+            all[n].pos = n;
+            all[n].cmp = cmp;
+            n++;
+        }
+
+    if (order == PICODICT_ORDER_HEADWORD)
+        qsort(all, total, sizeof(_pd_library_article),
+              _pd_library_article_cmp);
+
+    size_t count = limit && total > limit ? limit : total;
+    res->articles = malloc(count * sizeof(pd_result *));
+    res->dicts = malloc(count * sizeof(pd_dictionary *));
+    if (!res->articles || !res->dicts) {
+        free(res->articles);
+        res->articles = NULL;
+        free(all);
+        return false;
+    }
+    res->count = count;
+
+    for (size_t i = 0; i < total; ++i) {
+        if (i < res->count) {
+            res->articles[i] = all[i].article;
+            res->dicts[i] = all[i].dict;
+        } else {
+            pd_result_free(all[i].article);
+        }
+    }
+
+    /* Articles are owned by res->articles now */
+    for (size_t i = 0; i < res->found_count; ++i) {
+        free(res->found[i].articles);
+        res->found[i].articles = NULL;
+        res->found[i].count = 0;
+    }
+
+    free(all);
+    return true;
+}
+
+pd_library_result *
+pd_library_find(pd_library *lib, const char *text, pd_find_mode options,
+                pd_library_order order, size_t limit)
+{
+    if (lib->count == 0)
+        return NULL;
+
+    pd_library_result *res = calloc(1, sizeof(pd_library_result));
+    if (!res)
+        return NULL;
+    res->found = calloc(lib->count, sizeof(_pd_library_found));
+    if (!res->found)
+        goto err;
+    res->found_count = lib->count;
+    for (size_t i = 0; i < lib->count; ++i)
+        res->found[i].dict = lib->dicts[i].dict;
+
+    _pd_library_query q = {
+        .lib = lib,
+        .text = text,
+        .options = options,
+        .order = order,
+        .limit = limit,
+        .found = res->found,
+    };
+    pthread_mutex_init(&q.lock, NULL);
+    pthread_cond_init(&q.finished, NULL);
+
+    size_t threads = _pd_pool_threads(lib->pool) + 1;
+    if (threads > lib->count)
+        threads = lib->count;
+
+    for (size_t i = 1; i < threads; ++i) {
+        pthread_mutex_lock(&q.lock);
+        q.tasks++;
+        pthread_mutex_unlock(&q.lock);
+
+        if (!_pd_pool_submit(lib->pool, _pd_library_task, &q)) {
+            pthread_mutex_lock(&q.lock);
+            q.tasks--;
+            pthread_mutex_unlock(&q.lock);
+            break;
+        }
+    }
+
+    _pd_library_search(&q);
+
+    pthread_mutex_lock(&q.lock);
+    while (q.tasks)
+        pthread_cond_wait(&q.finished, &q.lock);
+    pthread_mutex_unlock(&q.lock);
+
+    pthread_cond_destroy(&q.finished);
+    pthread_mutex_destroy(&q.lock);
+
+    if (!_pd_library_merge(res, limit, order))
+        goto err;
+
+    if (res->count == 0)
+        goto err;
+
+    return res;
+
+err:
+    pd_library_result_free(res);
+    return NULL;
+}
+
+size_t
+pd_library_result_count(pd_library_result *r)
+{
+    return r->count;
+}
+
+pd_dictionary *
+pd_library_result_dictionary(pd_library_result *r, size_t n)
+{
+    return n < r->count ? r->dicts[n] : NULL;
+}
+
+pd_result *
+pd_library_result_get(pd_library_result *r, size_t n)
+{
+    return n < r->count ? r->articles[n] : NULL;
+}
+
+void
+pd_library_result_free(pd_library_result *r)
+{
+    if (r->articles)
+        for (size_t i = 0; i < r->count; ++i)
+            pd_result_free(r->articles[i]);
+    for (size_t i = 0; i < r->found_count; ++i) {
+        for (size_t j = 0; j < r->found[i].count; ++j)
+            pd_result_free(r->found[i].articles[j]);
+        free(r->found[i].articles);
+    }
+    free(r->found);
+    free(r->articles);
+    free(r->dicts);
+    free(r);
+}
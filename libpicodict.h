@@ -24,12 +24,33 @@
 
 struct pd_dictionary;
 struct pd_result;
+struct pd_cache;
+struct pd_library;
+struct pd_library_result;
+struct pd_request;
 
 typedef struct pd_dictionary pd_dictionary;
 typedef struct pd_result pd_result;
+typedef struct pd_cache pd_cache;
+typedef struct pd_library pd_library;
+typedef struct pd_library_result pd_library_result;
+typedef struct pd_request pd_request;
 
 /* -- Dictionary -- */
 
+/*
+ * Dictionary object may be shared between threads: pd_name(), pd_find() and
+ * pd_result_* functions may be called concurrently on the same dictionary.
+ * Index and data files are shared read-only, decompression state is taken
+ * per call and cache of decompressed data is locked internally.
+ *
+ * Single pd_result object should not be used by several threads at once.
+ * pd_close() should not be called while dictionary is still in use.
+ *
+ * Case of non-UTF-8 headwords is folded by tolower(), so locale (LC_CTYPE)
+ * should not be changed while dictionaries are open.
+ */
+
 typedef enum {
     PICODICT_INVALID = -1,
     PICODICT_OK,
@@ -38,6 +59,11 @@ typedef enum {
 typedef enum {
     PICODICT_FIND_EXACT,
     PICODICT_FIND_STARTS_WITH,
+    /*
+     * Words within Levenshtein distance 1 (for words up to 4 letters) or 2
+     * (for longer ones), closest first.
+     */
+    PICODICT_FIND_FUZZY,
 } pd_find_mode;
 
 typedef enum {
@@ -45,6 +71,12 @@ typedef enum {
     PICODICT_SORT_UNKNOWN = -1,
     PICODICT_SORT_ALPHABET,
     PICODICT_SORT_SKIPUNALPHA,
+    /*
+     * Same as above, but non-ASCII characters are case-folded too. UTF-8
+     * encoding of headwords is assumed.
+     */
+    PICODICT_SORT_ALPHABET_UTF8,
+    PICODICT_SORT_SKIPUNALPHA_UTF8,
 } pd_sort_mode;
 
 /*
@@ -57,6 +89,88 @@ typedef enum {
 pd_dictionary *
 pd_open(const char *index_file, const char *data_file, pd_sort_mode sort_mode);
 
+typedef enum {
+    /*
+     * Build table of case-folded headwords on opening. Headwords are compared
+     * with memcmp() during search, instead of being folded (and stripped of
+     * non-alphanumerics for SKIPUNALPHA sort modes) on every comparison.
+     *
+     * Table takes about as much memory as headwords themselves, plus a line
+     * offset table if there is no sidecar one (see pd_build_line_table()).
+     * Dictionary is opened without table if it can't be built.
+     */
+    PICODICT_OPEN_NORMALIZED_KEYS = 1 << 0,
+    /*
+     * Read data of articles ahead as soon as they are found: chunks of .dz
+     * files are decompressed into cache by a background thread, so iterating
+     * over results of prefix search does not wait for decompression. Up to
+     * half of cache is used for chunks read ahead.
+     */
+    PICODICT_OPEN_PREFETCH = 1 << 1,
+    /*
+     * Keep decompressed chunks of .dz files in chunk store file, so they are
+     * not decompressed again after restart, and are shared with other
+     * processes using the same dictionary. See chunk_store_* options.
+     */
+    PICODICT_OPEN_CHUNK_STORE = 1 << 2,
+    /*
+     * Keep chunk store in shared memory instead of a file, so every chunk of
+     * .dz file is decompressed once by all processes on the machine. Store
+     * stays in memory until reboot. chunk_store_dir is ignored.
+     *
+     * Store is writable by the user who created it only. Processes of other
+     * users read chunks from it, but don't add the ones they decompress.
+     */
+    PICODICT_OPEN_SHARED_CHUNKS = 1 << 3,
+} pd_open_flags;
+
+typedef struct {
+    /*
+     * Number of threads expected to look words up in dictionary
+     * simultaneously. Cache of decompressed data is split into this many
+     * independently locked parts. 0 means 1.
+     */
+    unsigned concurrency;
+
+    /*
+     * Amount of memory to be used for caching decompressed data of .dz
+     * dictionaries, in bytes. Least recently used data is dropped from cache
+     * once it is full. 0 means default, which is enough to hold a few chunks
+     * of compressed file.
+     */
+    size_t cache_size;
+
+    /*
+     * Cache shared with other dictionaries, see pd_cache_new(). If set,
+     * cache_size is ignored.
+     */
+    pd_cache *cache;
+
+    /* Bitwise OR of pd_open_flags */
+    unsigned flags;
+
+    /*
+     * Directory of chunk store file. NULL means the directory of data file.
+     * Store file is named after data file, with .chunks suffix added.
+     */
+    const char *chunk_store_dir;
+
+    /*
+     * Size of chunk store file, in bytes. 0 means 32 Mb. Store is never
+     * bigger than decompressed data file. Processes sharing store file should
+     * use the same size.
+     */
+    size_t chunk_store_size;
+} pd_open_options;
+
+/*
+ * Same as pd_open(), but takes additional options. Passing NULL options is
+ * the same as passing zero-initialized structure.
+ */
+pd_dictionary *
+pd_open_ext(const char *index_file, const char *data_file,
+            pd_sort_mode sort_mode, const pd_open_options *options);
+
 /*
  * Returns name of dictionary as stored inside it. Returned string is to be
  * freed by caller.
@@ -75,6 +189,36 @@ pd_name(pd_dictionary *d);
 pd_result *
 pd_find(pd_dictionary *d, const char *text, pd_find_mode options);
 
+typedef struct {
+    /* Points into index of dictionary, not NUL-terminated */
+    const char *headword;
+    size_t length;
+} pd_headword;
+
+/*
+ * Looks for words starting with prefix and stores up to k of them, in index
+ * order, to out_headwords. Returns number of stored headwords.
+ *
+ * Unlike pd_find(), this does not allocate memory and does not touch
+ * articles, so it is cheap enough to be called on every keystroke. Headwords
+ * stay valid until dictionary is closed.
+ */
+size_t
+pd_complete(pd_dictionary *d, const char *prefix, size_t k,
+            pd_headword *out_headwords);
+
+/*
+ * Looks for n words at once. Result for words[i] is stored to results[i], NULL
+ * is stored if nothing is found. Returns number of non-empty results.
+ *
+ * Words are sorted and looked up in order, each search starting where the
+ * previous one has stopped, so this is faster than calling pd_find() for
+ * every word. Use pd_result_article_batch() to read articles of results.
+ */
+size_t
+pd_find_batch(pd_dictionary *d, const char **words, size_t n,
+              pd_find_mode options, pd_result **results);
+
 /*
  * Deallocates passed dictionary object.
  *
@@ -84,14 +228,75 @@ pd_find(pd_dictionary *d, const char *text, pd_find_mode options);
 void
 pd_close(pd_dictionary *d);
 
+/* -- Shared cache -- */
+
+/*
+ * By default every dictionary caches its decompressed data separately. Cache
+ * object allows to share single memory budget between many dictionaries, so
+ * the most used ones get the most memory.
+ */
+
+/*
+ * Creates cache holding up to size bytes of decompressed data. concurrency
+ * has the same meaning as in pd_open_options.
+ *
+ * Cache is passed to pd_open_ext() in pd_open_options. Returned object is to
+ * be disposed by passing into pd_cache_free(). Dictionaries hold their own
+ * references to the cache, so it may be freed before they are closed.
+ */
+pd_cache *
+pd_cache_new(size_t size, unsigned concurrency);
+
+/*
+ * Releases cache object.
+ */
+void
+pd_cache_free(pd_cache *cache);
+
+typedef struct {
+    unsigned long hits;      /* chunks found in cache */
+    unsigned long misses;    /* chunks decompressed */
+    unsigned long evictions; /* chunks dropped to fit into cache size */
+    size_t chunks;           /* chunks in cache now */
+    size_t size;             /* bytes used by cached chunks now */
+} pd_cache_stats;
+
+/*
+ * Fills stats with counters of cache since its creation.
+ */
+void
+pd_cache_get_stats(pd_cache *cache, pd_cache_stats *stats);
+
 /* -- Result set -- */
 
 /*
- * Returns dictionary article from result.
+ * Returns dictionary article from result. Returned data is owned by result
+ * and is valid until result is freed.
+ *
+ * Articles of compressed dictionaries are usually not copied: returned
+ * pointer points directly into cache of decompressed data, which is kept in
+ * memory while result is alive. Keeping many results with read articles
+ * around may hence make cache to exceed its size.
  */
 const char *
 pd_result_article(pd_result *r, size_t *size);
 
+/*
+ * Reads articles of n results at once, so subsequent pd_result_article()
+ * calls return immediately. Articles are read in the order they are stored in
+ * data file, so every compressed chunk is decompressed only once. NULL
+ * entries in results are skipped.
+ */
+void
+pd_result_article_batch(pd_result **results, size_t n);
+
+/*
+ * Returns headword of result's article. It is not NUL-terminated. Useful for
+ * fuzzy search, where headwords differ from query.
+ */
+const char *
+pd_result_headword(pd_result *r, size_t *length);
+
 /*
  * Advances to next dictionary article from result. Returned is new pd_result
  * object, so don't forget to free passed one when finished working with it.
@@ -107,6 +312,283 @@ pd_result_next(pd_result *r);
 void
 pd_result_free(pd_result *r);
 
+/*
+ * Returns number of dictionary articles from r to the end of result,
+ * including r itself.
+ *
+ * With a line offset table (see pd_build_line_table()) this does not scan
+ * index, but takes two binary searches over the table, O(log n) in the number
+ * of index lines. Otherwise it takes a single pass over lines of result.
+ */
+size_t
+pd_result_count(pd_result *r);
+
+/*
+ * Moves r n articles forward in place. Returns 0 and leaves r untouched if
+ * result has less articles than that.
+ */
+int
+pd_result_seek(pd_result *r, size_t n);
+
+/*
+ * Iterator over articles of result. Unlike pd_result, it does not need to be
+ * allocated on heap and moves from article to article in place.
+ *
+ * pd_iter_find() (returning 1) should be paired with pd_iter_done(). All
+ * fields are private.
+ */
+typedef struct {
+    pd_dictionary *dict;
+    const char *start;
+    const char *end;
+    const char *entry;
+    size_t position;
+    size_t count;
+    size_t start_line;
+
+    const char *article;
+    size_t article_length;
+    void *article_chunk;
+    int article_allocated;
+} pd_iter;
+
+/*
+ * Same as pd_find(), but stores result to iterator pointing to its first
+ * article. Returns 0 if nothing is found. PICODICT_FIND_FUZZY is not
+ * supported.
+ */
+int
+pd_iter_find(pd_iter *it, pd_dictionary *d, const char *text,
+             pd_find_mode options);
+
+/*
+ * Same as pd_result_article(). Returned article is valid until iterator is
+ * moved.
+ */
+const char *
+pd_iter_article(pd_iter *it, size_t *size);
+
+/*
+ * Returns headword of current article. It is not NUL-terminated.
+ */
+const char *
+pd_iter_headword(pd_iter *it, size_t *length);
+
+/*
+ * Moves to the next article. Returns 0 if there are no more articles.
+ */
+int
+pd_iter_next(pd_iter *it);
+
+/*
+ * Returns total number of articles in result, see pd_result_count(). With a
+ * line offset table the count is known since pd_iter_find(), so this is O(1).
+ */
+size_t
+pd_iter_count(pd_iter *it);
+
+/*
+ * Moves to n-th article of result, counting from 0, so paged views may jump
+ * directly to any page. Returns 0 and leaves iterator untouched if there is no
+ * such article.
+ */
+int
+pd_iter_seek(pd_iter *it, size_t n);
+
+/*
+ * Releases resources held by iterator.
+ */
+void
+pd_iter_done(pd_iter *it);
+
+/* -- Asynchronous lookups -- */
+
+/*
+ * Lookups and article reads may be done by background threads of dictionary,
+ * so that calling thread never waits for index pages to be read or for data
+ * to be decompressed. Completion is reported by callback, which is called in
+ * background thread (or in calling thread, if background thread can't be
+ * started). Callback of event loop may write to eventfd or pipe polled by the
+ * loop to wake it up.
+ *
+ * All requests should be freed before dictionary is closed.
+ */
+
+typedef void (*pd_request_callback)(pd_request *req, void *data);
+
+/*
+ * Starts pd_find() in background. callback may be NULL, then completion
+ * should be checked with pd_request_done(). Returns NULL if memory can't be
+ * allocated.
+ */
+pd_request *
+pd_find_async(pd_dictionary *d, const char *text, pd_find_mode options,
+              pd_request_callback callback, void *data);
+
+/*
+ * Starts pd_result_article() in background. Result may be used and freed
+ * while request is in progress. Returns NULL if memory can't be allocated.
+ */
+pd_request *
+pd_article_async(pd_result *r, pd_request_callback callback, void *data);
+
+/*
+ * Returns 1 if request is complete and not cancelled.
+ */
+int
+pd_request_done(pd_request *req);
+
+/*
+ * Returns result of complete pd_find_async() request, or NULL if nothing is
+ * found. Result is owned by caller, and should be freed with
+ * pd_result_free(). Subsequent calls return NULL.
+ */
+pd_result *
+pd_request_result(pd_request *req);
+
+/*
+ * Returns article read by complete pd_article_async() request, or NULL if it
+ * can't be read. Article is owned by request and is valid until it is freed.
+ */
+const char *
+pd_request_article(pd_request *req, size_t *size);
+
+/*
+ * Cancels request, e.g. when user has already typed next letter. Returns 1 if
+ * request is cancelled and callback is not going to be called, 0 if request
+ * is already complete.
+ *
+ * Lookup already in progress is finished in background, but its result is
+ * thrown away.
+ */
+int
+pd_request_cancel(pd_request *req);
+
+/*
+ * Frees request. Request which is not complete yet is cancelled.
+ */
+void
+pd_request_free(pd_request *req);
+
+/* -- Library -- */
+
+/*
+ * Library searches a set of dictionaries at once, using a pool of worker
+ * threads. Library does not own dictionaries: they should be closed by
+ * caller after library is freed.
+ *
+ * pd_library_find() may be called concurrently, pd_library_add() should not
+ * be called while library is in use.
+ */
+
+typedef enum {
+    /* Articles of dictionaries with higher priority first */
+    PICODICT_ORDER_PRIORITY,
+    /*
+     * Articles sorted by headword, in sort order of dictionaries if all of
+     * them have the same sort mode, or ignoring case of UTF-8 otherwise.
+     */
+    PICODICT_ORDER_HEADWORD,
+} pd_library_order;
+
+/*
+ * Creates library searching dictionaries in given number of threads, calling
+ * thread included. 0 threads means one thread per online CPU. Returns NULL if
+ * memory can't be allocated.
+ */
+pd_library *
+pd_library_new(unsigned threads);
+
+/*
+ * Adds dictionary to library. Dictionaries with equal priority are ordered
+ * the way they were added. Returns 0 if memory can't be allocated.
+ */
+int
+pd_library_add(pd_library *lib, pd_dictionary *d, int priority);
+
+/*
+ * Frees library. Dictionaries are not closed.
+ */
+void
+pd_library_free(pd_library *lib);
+
+/*
+ * Looks text up in all dictionaries of library in parallel, and returns at
+ * most limit articles (0 means no limit) in given order. Articles of single
+ * dictionary retain their order.
+ *
+ * With PICODICT_ORDER_PRIORITY dictionaries are searched in order of
+ * priority, and dictionaries not needed to get limit articles are not
+ * searched at all.
+ *
+ * Returns NULL if nothing is found.
+ */
+pd_library_result *
+pd_library_find(pd_library *lib, const char *text, pd_find_mode options,
+                pd_library_order order, size_t limit);
+
+/*
+ * Returns number of articles in result.
+ */
+size_t
+pd_library_result_count(pd_library_result *r);
+
+/*
+ * Returns dictionary n-th article of result comes from.
+ */
+pd_dictionary *
+pd_library_result_dictionary(pd_library_result *r, size_t n);
+
+/*
+ * Returns n-th article of result: pd_result_article() and
+ * pd_result_headword() may be called on it. Returned object is owned by
+ * library result and should not be freed or passed to pd_result_next().
+ */
+pd_result *
+pd_library_result_get(pd_library_result *r, size_t n);
+
+/*
+ * Frees library result.
+ */
+void
+pd_library_result_free(pd_library_result *r);
+
+/* -- Statistics -- */
+
+/*
+ * Counters of dictionary activity since it was opened or since
+ * pd_reset_stats() was called. Counters are maintained always, they are cheap.
+ *
+ * cache_evictions counts chunks dropped from cache to fit chunks of this
+ * dictionary into cache size. With shared cache, they may be chunks of other
+ * dictionaries.
+ */
+typedef struct {
+    unsigned long lookups;         /* words looked up */
+    unsigned long probes;          /* index lines visited by search */
+    unsigned long comparisons;     /* headword comparisons */
+    unsigned long cache_hits;      /* chunks found in cache */
+    unsigned long cache_misses;    /* chunks decompressed */
+    unsigned long cache_evictions; /* chunks dropped to fit this one's */
+    unsigned long bytes_inflated;  /* bytes produced by decompression */
+    unsigned long inflate_usec;    /* time spent in decompression */
+    unsigned long filtered;        /* lookups rejected by Bloom filter */
+    unsigned long store_hits;      /* chunks read from chunk store */
+} pd_stats;
+
+/*
+ * Fills stats with current values of dictionary counters. Counters updated
+ * concurrently by other threads may be slightly out of sync with each other.
+ */
+void
+pd_get_stats(pd_dictionary *d, pd_stats *stats);
+
+/*
+ * Resets dictionary counters to zero.
+ */
+void
+pd_reset_stats(pd_dictionary *d);
+
 /* -- Testing validity of files -- */
 
 /*
@@ -128,8 +610,83 @@ pd_validate(const char *index_file, const char *data_file);
 
 /*
  * This function detects sort mode to be passed into pd_open().
+ *
+ * UTF-8 sort modes are preferred if there are non-ASCII headwords in index,
+ * so lookups do not depend on case of non-ASCII letters.
  */
 pd_sort_mode
 pd_get_sort_mode(const char *index_file, const char *data_file);
 
+/*
+ * Same as pd_validate() and pd_get_sort_mode(), but work is split between
+ * given number of threads. 0 threads means one thread per online CPU.
+ */
+pd_dict_stat
+pd_validate_parallel(const char *index_file, const char *data_file,
+                     unsigned threads);
+
+pd_sort_mode
+pd_get_sort_mode_parallel(const char *index_file, const char *data_file,
+                          unsigned threads);
+
+/* -- Sidecar files -- */
+
+/*
+ * Sidecar files contain precomputed data speeding up lookups. They are built
+ * once, like pd_validate() is run once, and are picked up by pd_open()
+ * automatically if they are found next to index file and index file has not
+ * been changed since they were built. Dictionary works without them, just
+ * slower.
+ */
+
+/*
+ * Builds table of offsets of index lines, so lookups do not need to scan index
+ * for line boundaries. Table is stored to table_file, or to
+ * <index_file>.lines if table_file is NULL.
+ *
+ * Index files bigger than 4Gb are not supported.
+ */
+pd_dict_stat
+pd_build_line_table(const char *index_file, const char *table_file);
+
+/*
+ * Builds trie of headwords of index, sorted in given sort mode, so lookups
+ * cost O(length of word) instead of binary search over the whole index. Trie
+ * is stored to trie_file, or to <index_file>.trie if trie_file is NULL. It is
+ * used only by dictionaries opened with the same sort mode.
+ *
+ * Only prefixes shared by many headwords get trie nodes, so trie is several
+ * times smaller than index.
+ *
+ * Returns PICODICT_INVALID if index is not sorted in given sort mode.
+ */
+pd_dict_stat
+pd_build_trie(const char *index_file, pd_sort_mode sort_mode,
+              const char *trie_file);
+
+/*
+ * Builds Bloom filter of headwords of index, so exact lookups of most words
+ * missing from dictionary return without searching index. Filter is stored
+ * to bloom_file, or to <index_file>.bloom if bloom_file is NULL. It is used
+ * only by dictionaries opened with the same sort mode.
+ *
+ * Filter takes 12 bits per headword, less than 1% of missing words pass it.
+ */
+pd_dict_stat
+pd_build_bloom(const char *index_file, pd_sort_mode sort_mode,
+               const char *bloom_file);
+
+/*
+ * Builds minimal perfect hash of headwords of index, so exact lookups cost a
+ * hash computation and a single headword comparison. Hash is stored to
+ * hash_file, or to <index_file>.phash if hash_file is NULL. It is used only
+ * by dictionaries opened with the same sort mode, and takes about 9 bytes per
+ * distinct headword.
+ *
+ * Returns PICODICT_INVALID if index is not sorted in given sort mode.
+ */
+pd_dict_stat
+pd_build_perfect_hash(const char *index_file, pd_sort_mode sort_mode,
+                      const char *hash_file);
+
 #endif
@@ -0,0 +1,316 @@
+/*
+ * libpicodict - dictd dictionary format reading library
+ *
+ * Copyright © 2010 Mikhail Gusarov <dottedmag@dottedmag.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libpicodict.h"
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+            "Usage: picodict-bench [options] <.index>\n"
+            "\n"
+            "  -q <file>   read queries from file, one per line\n"
+            "              (default: sample headwords from index)\n"
+            "  -n <count>  number of lookups (default: 100000)\n"
+            "  -m <mode>   exact, prefix or both (default: both)\n"
+            "  -p <len>    prefix length for sampled prefix queries (default: 3)\n"
+            "  -k <count>  articles to read per prefix lookup (default: 10)\n"
+            "  -c <bytes>  chunk cache size (default: 262144)\n"
+            "  -o <mode>   sort mode: alphabet, skipunalpha, alphabet-utf8 or\n"
+            "              skipunalpha-utf8 (default: detected from index)\n"
+            "  -s          same as -o skipunalpha\n"
+            "  -N          build normalized key table on opening\n"
+            "  -P          read articles ahead in background\n"
+            "  -S          keep inflated chunks in chunk store file\n"
+            "  -H          keep inflated chunks in shared memory\n"
+            "  -r <seed>   random seed for sampling (default: 1)\n");
+    exit(1);
+}
+
+static char **
+read_lines(const char *filename, size_t *count, bool headwords)
+{
+    FILE *f = fopen(filename, "r");
+    if (!f) {
+        perror(filename);
+        exit(1);
+    }
+
+    size_t allocated = 1024;
+    char **lines = malloc(allocated * sizeof(char *));
+    *count = 0;
+
+    char *line = NULL;
+    size_t len = 0;
+    ssize_t read;
+    while ((read = getline(&line, &len, f)) != -1) {
+        char *end = strchr(line, headwords ? '\t' : '\n');
+        if (end)
+            *end = '\0';
+        if (!*line)
+            continue;
+        if (headwords && (!strncmp(line, "00database", 10)
+                          || !strncmp(line, "00-database-", 12)))
+            continue;
+
+        if (*count == allocated) {
+            allocated *= 2;
+            lines = realloc(lines, allocated * sizeof(char *));
+        }
+        lines[(*count)++] = strdup(line);
+    }
+
+    free(line);
+    fclose(f);
+    return lines;
+}
+
+static const char *sort_modes[] = {
+    [PICODICT_SORT_ALPHABET] = "alphabet",
+    [PICODICT_SORT_SKIPUNALPHA] = "skipunalpha",
+    [PICODICT_SORT_ALPHABET_UTF8] = "alphabet-utf8",
+    [PICODICT_SORT_SKIPUNALPHA_UTF8] = "skipunalpha-utf8",
+};
+
+static pd_sort_mode
+parse_sort_mode(const char *name)
+{
+    for (size_t i = 0; i < sizeof(sort_modes) / sizeof(sort_modes[0]); ++i)
+        if (!strcmp(name, sort_modes[i]))
+            return i;
+    usage();
+    return PICODICT_SORT_UNKNOWN;
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+cmp_double(const void *lhs, const void *rhs)
+{
+    double l = *(const double *)lhs;
+    double r = *(const double *)rhs;
+    return l < r ? -1 : l > r;
+}
+
+static long
+proc_status_kb(const char *field)
+{
+    FILE *f = fopen("/proc/self/status", "r");
+    if (!f)
+        return -1;
+
+    long ret = -1;
+    char line[256];
+    while (fgets(line, sizeof(line), f))
+        if (!strncmp(line, field, strlen(field))) {
+            ret = atol(line + strlen(field));
+            break;
+        }
+
+    fclose(f);
+    return ret;
+}
+
+static void
+run(pd_dictionary *d, const char *name, char **queries, size_t nqueries,
+    size_t count, pd_find_mode mode, int articles)
+{
+    double *latency = malloc(count * sizeof(double));
+    size_t found = 0;
+
+    pd_reset_stats(d);
+
+    double start = now();
+    for (size_t i = 0; i < count; ++i) {
+        double t = now();
+
+        pd_result *r = pd_find(d, queries[i % nqueries], mode);
+        if (r)
+            found++;
+        for (int j = 0; r && j < articles; ++j) {
+            size_t size;
+            pd_result_article(r, &size);
+            pd_result *next = pd_result_next(r);
+            pd_result_free(r);
+            r = next;
+        }
+        if (r)
+            pd_result_free(r);
+
+        latency[i] = now() - t;
+    }
+    double total = now() - start;
+
+    pd_stats stats;
+    pd_get_stats(d, &stats);
+    qsort(latency, count, sizeof(double), cmp_double);
+
+    unsigned long hits = stats.cache_hits;
+    unsigned long misses = stats.cache_misses;
+
+    printf("%s:\n", name);
+    printf("  lookups:          %zu (%zu found)\n", count, found);
+    printf("  lookups/s:        %.0f\n", count / total);
+    printf("  latency p50:      %.2f us\n", latency[count / 2] * 1e6);
+    printf("  latency p99:      %.2f us\n", latency[count * 99 / 100] * 1e6);
+    printf("  probes/lookup:    %.2f\n", (double)stats.probes / count);
+    printf("  compares/lookup:  %.2f\n", (double)stats.comparisons / count);
+    printf("  chunk inflations: %lu (%lu bytes, %.2f ms)\n",
+           misses - stats.store_hits, stats.bytes_inflated,
+           stats.inflate_usec / 1e3);
+    printf("  chunk store hits: %lu\n", stats.store_hits);
+    printf("  cache hit rate:   %.2f%%\n",
+           hits + misses ? 100.0 * hits / (hits + misses) : 0.0);
+
+    free(latency);
+}
+
+int main(int argc, char **argv)
+{
+    const char *query_file = NULL;
+    size_t count = 100000;
+    bool exact = true;
+    bool prefix = true;
+    size_t prefix_len = 3;
+    int articles = 10;
+    size_t cache_size = 256 * 1024;
+    pd_sort_mode sort_mode = PICODICT_SORT_UNKNOWN;
+    unsigned seed = 1;
+    unsigned flags = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "q:n:m:p:k:c:o:sNPSHr:")) != -1) {
+        switch (opt) {
+        case 'q': query_file = optarg; break;
+        case 'n': count = strtoul(optarg, NULL, 10); break;
+        case 'm':
+            exact = !strcmp(optarg, "exact") || !strcmp(optarg, "both");
+            prefix = !strcmp(optarg, "prefix") || !strcmp(optarg, "both");
+            if (!exact && !prefix)
+                usage();
+            break;
+        case 'p': prefix_len = strtoul(optarg, NULL, 10); break;
+        case 'k': articles = atoi(optarg); break;
+        case 'c': cache_size = strtoul(optarg, NULL, 10); break;
+        case 'o': sort_mode = parse_sort_mode(optarg); break;
+        case 's': sort_mode = PICODICT_SORT_SKIPUNALPHA; break;
+        case 'N': flags |= PICODICT_OPEN_NORMALIZED_KEYS; break;
+        case 'P': flags |= PICODICT_OPEN_PREFETCH; break;
+        case 'S': flags |= PICODICT_OPEN_CHUNK_STORE; break;
+        case 'H': flags |= PICODICT_OPEN_SHARED_CHUNKS; break;
+        case 'r': seed = strtoul(optarg, NULL, 10); break;
+        default: usage();
+        }
+    }
+
+    if (optind != argc - 1 || count == 0)
+        usage();
+
+    const char *index_file = argv[optind];
+    char *s = strdup(index_file);
+    char *s2 = strrchr(s, '.');
+    if (s2)
+        *s2 = 0;
+
+    char dz[1024];
+    snprintf(dz, sizeof(dz), "%s.dict.dz", s);
+    free(s);
+
+    if (sort_mode == PICODICT_SORT_UNKNOWN) {
+        sort_mode = pd_get_sort_mode(index_file, dz);
+        if (sort_mode < 0) {
+            fprintf(stderr, "Unable to detect sort mode of %s\n", index_file);
+            return 1;
+        }
+    }
+    printf("sort mode: %s\n", sort_modes[sort_mode]);
+
+    size_t nqueries;
+    char **queries = read_lines(query_file ? query_file : index_file,
+                                &nqueries, !query_file);
+    if (nqueries == 0) {
+        fprintf(stderr, "No queries\n");
+        return 1;
+    }
+
+    /* Sample headwords in random order */
+    srand(seed);
+    char **sample = malloc(count * sizeof(char *));
+    char **prefixes = malloc(count * sizeof(char *));
+    for (size_t i = 0; i < count; ++i) {
+        sample[i] = queries[query_file ? i % nqueries : rand() % nqueries];
+        prefixes[i] = strndup(sample[i], query_file ? strlen(sample[i])
+                                                    : prefix_len);
+    }
+
+    long rss_before = proc_status_kb("VmRSS:");
+
+    pd_cache *cache = pd_cache_new(cache_size, 1);
+    pd_open_options options = { .cache = cache, .flags = flags };
+
+    double t = now();
+    pd_dictionary *d = pd_open_ext(index_file, dz, sort_mode, &options);
+    if (!d) {
+        fprintf(stderr, "Unable to open %s\n", index_file);
+        return 1;
+    }
+    printf("open: %.2f ms\n", (now() - t) * 1e3);
+
+    if (exact)
+        run(d, "exact", sample, count, count, PICODICT_FIND_EXACT, 1);
+    if (prefix)
+        run(d, "prefix", prefixes, count, count,
+            PICODICT_FIND_STARTS_WITH, articles);
+
+    pd_cache_stats stats;
+    pd_cache_get_stats(cache, &stats);
+    printf("cache: %zu chunks, %zu bytes, %lu evictions\n",
+           stats.chunks, stats.size, stats.evictions);
+    printf("rss: %ld kB (%ld kB before open), peak %ld kB\n",
+           proc_status_kb("VmRSS:"), rss_before, proc_status_kb("VmHWM:"));
+
+    pd_close(d);
+    pd_cache_free(cache);
+
+    for (size_t i = 0; i < count; ++i)
+        free(prefixes[i]);
+    free(prefixes);
+    free(sample);
+    for (size_t i = 0; i < nqueries; ++i)
+        free(queries[i]);
+    free(queries);
+
+    return 0;
+}